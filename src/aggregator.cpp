@@ -0,0 +1,305 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015, 2016 Jacob McGladdery
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "aggregator.h"
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+
+#include <cstdlib>
+#include <cstring>
+
+namespace aggregate {
+
+namespace {
+
+bool parseMode(const std::string& text, Mode& mode) {
+    if ("pass" == text)
+        mode = PassThrough;
+    else if ("window" == text)
+        mode = Window;
+    else if ("deadband" == text)
+        mode = Deadband;
+    else if ("change" == text)
+        mode = OnChange;
+    else
+        return false;
+
+    return true;
+}
+
+} // namespace
+
+Aggregator::Aggregator(Emit emit)
+    : emit_(std::move(emit))
+    , tick_(0)
+    , configured_(false)
+{
+    std::memset(states_, 0, sizeof(states_));
+    for (auto& state : states_) {
+        state.config.mode = PassThrough;
+        state.next = -1;
+    }
+
+    for (auto& head : wheel_) {
+        head = -1;
+    }
+}
+
+void Aggregator::configure(signals::SignalId signal, const Config& config) {
+    State& state = states_[signal];
+
+    if (state.open) {
+        unschedule(signal);
+        state.open = false;
+    }
+
+    state.config = config;
+    state.emitted = false;
+    configured_ = configured_ || config.mode != PassThrough;
+}
+
+bool Aggregator::parseConfig(std::istream& in) {
+    std::string line;
+    unsigned int lineNumber = 0;
+
+    while (std::getline(in, line)) {
+        ++lineNumber;
+
+        // Strip comments
+        const auto hash = line.find('#');
+        if (hash != std::string::npos)
+            line.erase(hash);
+
+        std::istringstream tokens(line);
+        std::string name, mode;
+        Config config = Config();
+
+        if (!(tokens >> name))
+            continue;
+
+        std::uint32_t signal = 0;
+        while (signal < signals::NumSignals &&
+               name != signals::signalName(static_cast<signals::SignalId>(signal)))
+            ++signal;
+        if (signal == signals::NumSignals) {
+            std::cerr << "line " << lineNumber
+                      << ": unknown signal " << name << std::endl;
+            return false;
+        }
+
+        if (!(tokens >> mode) || !parseMode(mode, config.mode)) {
+            std::cerr << "line " << lineNumber
+                      << ": expected pass, window, deadband or change" << std::endl;
+            return false;
+        }
+
+        if (Window == config.mode || Deadband == config.mode) {
+            std::string parameter;
+            char* end;
+
+            if (!(tokens >> parameter)) {
+                std::cerr << "line " << lineNumber
+                          << ": missing " << mode << " parameter" << std::endl;
+                return false;
+            }
+
+            const long long value = std::strtoll(parameter.c_str(), &end, 0);
+            if (*end != '\0' || value <= 0 ||
+                (Window == config.mode && value > 3600000)) {
+                std::cerr << "line " << lineNumber
+                          << ": invalid " << mode << " " << parameter << std::endl;
+                return false;
+            }
+
+            if (Window == config.mode)
+                config.window = static_cast<std::uint64_t>(value) * kTick;
+            else
+                config.deadband = value;
+        }
+
+        configure(static_cast<signals::SignalId>(signal), config);
+    }
+
+    return true;
+}
+
+void Aggregator::add(signals::SignalId signal, std::int64_t value,
+                     std::uint64_t timestamp) {
+    State& state = states_[signal];
+
+    switch (state.config.mode) {
+    case PassThrough:
+        emitSample(signal, value, timestamp);
+        break;
+    case Deadband:
+    {
+        const std::int64_t delta = value - state.lastEmitted;
+        if (!state.emitted || delta >= state.config.deadband ||
+            -delta >= state.config.deadband)
+            emitSample(signal, value, timestamp);
+    }
+        break;
+    case OnChange:
+        if (!state.emitted || value != state.lastEmitted)
+            emitSample(signal, value, timestamp);
+        break;
+    case Window:
+        // A sample past the deadline closes the window before the wheel does
+        if (state.open && timestamp >= state.deadline) {
+            unschedule(signal);
+            closeWindow(signal);
+        }
+
+        if (!state.open) {
+            state.open = true;
+            state.min = value;
+            state.max = value;
+            state.sum = 0;
+            state.count = 0;
+            state.deadline = timestamp - timestamp % state.config.window +
+                state.config.window;
+            schedule(signal);
+        }
+
+        if (value < state.min)
+            state.min = value;
+        if (value > state.max)
+            state.max = value;
+        state.sum += value;
+        state.last = value;
+        ++state.count;
+        break;
+    }
+}
+
+void Aggregator::advance(std::uint64_t now) {
+    const std::uint64_t tick = now / kTick;
+
+    if (tick <= tick_)
+        return;
+
+    // After a long gap every slot is visited once
+    const std::uint64_t first = (tick - tick_ > kWheelSlots)
+        ? tick - kWheelSlots + 1 : tick_ + 1;
+    tick_ = tick;
+
+    for (std::uint64_t t = first; t <= tick; ++t) {
+        int* link = &wheel_[t % kWheelSlots];
+
+        while (*link != -1) {
+            const auto signal = static_cast<signals::SignalId>(*link);
+            State& state = states_[signal];
+
+            // Windows further out stay for another turn of the wheel
+            if (state.deadline > now) {
+                link = &state.next;
+                continue;
+            }
+
+            *link = state.next;
+            state.next = -1;
+            closeWindow(signal);
+        }
+    }
+}
+
+void Aggregator::flush(std::uint64_t now) {
+    advance(now);
+
+    for (std::uint32_t signal = 0; signal < signals::NumSignals; ++signal) {
+        if (states_[signal].open) {
+            unschedule(static_cast<signals::SignalId>(signal));
+            closeWindow(static_cast<signals::SignalId>(signal));
+        }
+    }
+}
+
+void Aggregator::emitSample(signals::SignalId signal, std::int64_t value,
+                            std::uint64_t timestamp) {
+    State& state = states_[signal];
+    Output output;
+
+    state.emitted = true;
+    state.lastEmitted = value;
+
+    output.signal = signal;
+    output.mode = state.config.mode;
+    output.timestamp = timestamp;
+    output.last = value;
+    output.min = value;
+    output.max = value;
+    output.mean = static_cast<double>(value);
+    output.count = 1;
+    emit_(output);
+}
+
+void Aggregator::closeWindow(signals::SignalId signal) {
+    State& state = states_[signal];
+    Output output;
+
+    state.open = false;
+
+    output.signal = signal;
+    output.mode = Window;
+    output.timestamp = state.deadline;
+    output.last = state.last;
+    output.min = state.min;
+    output.max = state.max;
+    output.mean = static_cast<double>(state.sum) / state.count;
+    output.count = state.count;
+    emit_(output);
+}
+
+void Aggregator::schedule(signals::SignalId signal) {
+    State& state = states_[signal];
+
+    // Round up, so the window has ended when its slot comes around
+    std::uint64_t tick = (state.deadline + kTick - 1) / kTick;
+    if (tick <= tick_)
+        tick = tick_ + 1;
+
+    int& head = wheel_[tick % kWheelSlots];
+    state.next = head;
+    head = signal;
+}
+
+void Aggregator::unschedule(signals::SignalId signal) {
+    State& state = states_[signal];
+
+    // Slots hold few signals, so a search is cheaper than a back link
+    for (auto& head : wheel_) {
+        for (int* link = &head; *link != -1; link = &states_[*link].next) {
+            if (*link == static_cast<int>(signal)) {
+                *link = state.next;
+                state.next = -1;
+                return;
+            }
+        }
+    }
+}
+
+} // namespace aggregate
@@ -0,0 +1,146 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015, 2016 Jacob McGladdery
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+-------------------------------------------------------------------------------
+
+Signal Aggregation
+
+A streaming stage between the decoders and the output which reduces the rate
+of high-rate signals. Every signal is configured with one of these modes:
+
+ - pass: every sample is emitted, which is the default.
+ - window: samples are summarized per fixed time window as the minimum,
+   maximum, mean, last value and count, so peaks survive the downsampling.
+ - deadband: a sample is emitted when it differs from the last emitted value
+   by at least the deadband (send-on-delta).
+ - change: a sample is emitted when it differs from the last emitted value.
+
+The state of every signal lives in a flat array indexed by its SignalId. Open
+windows are kept on a hashed timer wheel with millisecond slots, so adding a
+sample never reads the clock; advance() closes the windows which are due.
+
+The configuration file holds one signal per line:
+
+    SIGNAL MODE [PARAMETER]
+
+Where the parameter is the window length in milliseconds or the deadband.
+*/
+
+#ifndef _AGGREGATOR_H_
+#define _AGGREGATOR_H_
+
+#include "signal-cache.h"
+
+#include <functional>
+#include <istream>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace aggregate {
+
+enum Mode : std::uint8_t {
+    PassThrough,
+    Window,
+    Deadband,
+    OnChange
+};
+
+struct Config {
+    Mode mode;
+    std::uint64_t window;  // Nanoseconds
+    std::int64_t deadband;
+};
+
+struct Output {
+    signals::SignalId signal;
+    Mode mode;
+    std::uint64_t timestamp; // End of the window, or the sample time
+    std::int64_t last;
+
+    // Summary of a window; a single sample otherwise
+    std::int64_t min;
+    std::int64_t max;
+    double mean;
+    std::uint64_t count;
+};
+
+// Timer wheel resolution and size
+constexpr std::uint64_t kTick = 1000000;
+constexpr std::size_t kWheelSlots = 256;
+
+class Aggregator {
+public:
+    using Emit = std::function<void(const Output&)>;
+
+    explicit Aggregator(Emit emit);
+
+    Aggregator(const Aggregator&) = delete;
+    Aggregator& operator=(const Aggregator&) = delete;
+
+    void configure(signals::SignalId signal, const Config& config);
+
+    // Errors are reported with their line number
+    bool parseConfig(std::istream& in);
+
+    bool configured() const { return configured_; }
+
+    void add(signals::SignalId signal, std::int64_t value, std::uint64_t timestamp);
+
+    // Close the windows which ended by now; returns at once within a tick
+    void advance(std::uint64_t now);
+
+    // Close every open window, such as at exit
+    void flush(std::uint64_t now);
+
+private:
+    struct State {
+        Config config;
+        bool open;     // A window has samples
+        bool emitted;  // lastEmitted is valid
+        std::int64_t min;
+        std::int64_t max;
+        std::int64_t sum;
+        std::int64_t last;
+        std::int64_t lastEmitted;
+        std::uint64_t count;
+        std::uint64_t deadline;
+        int next;      // Next signal in the same wheel slot, or -1
+    };
+
+    void emitSample(signals::SignalId signal, std::int64_t value,
+                    std::uint64_t timestamp);
+    void closeWindow(signals::SignalId signal);
+    void schedule(signals::SignalId signal);
+    void unschedule(signals::SignalId signal);
+
+    Emit emit_;
+    State states_[signals::NumSignals];
+    int wheel_[kWheelSlots];
+    std::uint64_t tick_; // Last tick advance() has processed
+    bool configured_;
+};
+
+} // namespace aggregate
+
+#endif /* _AGGREGATOR_H_ */
@@ -0,0 +1,716 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015, 2016 Jacob McGladdery
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "can-archive.h"
+
+#include <endian.h>
+
+#include <algorithm>
+#include <unordered_map>
+
+#include <cinttypes>
+#include <cstdlib>
+#include <cstring>
+
+namespace archive {
+
+namespace {
+
+constexpr std::uint32_t kFileMagic = 0x56484341; // "ACHV"
+constexpr std::uint32_t kBlockMagic = 0x4B434C42; // "BLCK"
+constexpr std::uint32_t kVersion = 1;
+
+// Flags byte of a dictionary key; the low bits are the CAN FD flags
+constexpr std::uint8_t kFdKey = 0x80;
+
+// Magic, count, min time, max time, unit, body size, reserved and the bitmap
+constexpr std::size_t kHeaderSize = 4 + 4 + 8 + 8 + 8 + 4 + 4 + 8 * kBitmapWords;
+
+struct BlockHeader {
+    std::uint32_t count;
+    std::uint64_t minTime;
+    std::uint64_t maxTime;
+    std::uint64_t unit;
+    std::uint32_t bodySize;
+    std::uint64_t bitmap[kBitmapWords];
+};
+
+// Per key state shared by the encoder and the decoder
+struct KeyState {
+    bool seen;
+    std::int64_t last;
+    std::int64_t delta;
+    std::uint8_t masks[CANFD_MAX_DLEN / 8];
+    std::uint8_t payload[CANFD_MAX_DLEN];
+};
+
+inline void putLe32(std::uint8_t* out, std::uint32_t value) {
+    value = htole32(value);
+    std::memcpy(out, &value, sizeof(value));
+}
+
+inline void putLe64(std::uint8_t* out, std::uint64_t value) {
+    value = htole64(value);
+    std::memcpy(out, &value, sizeof(value));
+}
+
+inline std::uint32_t getLe32(const std::uint8_t* in) {
+    std::uint32_t value;
+    std::memcpy(&value, in, sizeof(value));
+    return le32toh(value);
+}
+
+inline std::uint64_t getLe64(const std::uint8_t* in) {
+    std::uint64_t value;
+    std::memcpy(&value, in, sizeof(value));
+    return le64toh(value);
+}
+
+inline void putVarint(std::vector<std::uint8_t>& out, std::uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<std::uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<std::uint8_t>(value));
+}
+
+inline std::uint64_t zigzag(std::int64_t value) {
+    return (static_cast<std::uint64_t>(value) << 1) ^
+        static_cast<std::uint64_t>(value >> 63);
+}
+
+inline std::int64_t unzigzag(std::uint64_t value) {
+    return static_cast<std::int64_t>(value >> 1) ^
+        -static_cast<std::int64_t>(value & 1);
+}
+
+// Bounds checked reads from one column of a block body
+struct Cursor {
+    const std::uint8_t* p;
+    const std::uint8_t* end;
+
+    bool varint(std::uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (p == end)
+                return false;
+            const std::uint8_t byte = *p++;
+            value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                return true;
+        }
+        return false;
+    }
+
+    bool byte(std::uint8_t& value) {
+        if (p == end)
+            return false;
+        value = *p++;
+        return true;
+    }
+
+    // Split off the next length prefixed column
+    bool column(Cursor& out) {
+        std::uint64_t size;
+        if (!varint(size) || size > static_cast<std::uint64_t>(end - p))
+            return false;
+        out.p = p;
+        out.end = p + size;
+        p += size;
+        return true;
+    }
+};
+
+void appendColumn(std::vector<std::uint8_t>& body,
+                  const std::vector<std::uint8_t>& column) {
+    putVarint(body, column.size());
+    body.insert(body.end(), column.begin(), column.end());
+}
+
+// Identity of a frame for matching, without the RTR bit
+inline canid_t matchId(canid_t id) {
+    return id & (CAN_EFF_FLAG | CAN_ERR_FLAG | CAN_EFF_MASK);
+}
+
+inline int hexDigit(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+const char kHex[] = "0123456789ABCDEF";
+
+} // namespace
+
+unsigned int bitmapIndex(canid_t id) {
+    if (!(id & (CAN_EFF_FLAG | CAN_ERR_FLAG)))
+        return id & CAN_SFF_MASK;
+
+    return (matchId(id) * 2654435761u) >> 21;
+}
+
+bool parseLogLine(const std::string& line, std::string& interface,
+                  Record& record) {
+    const char* p = line.c_str();
+    char* end;
+
+    // Timestamp, with any number of fractional digits
+    if (*p++ != '(')
+        return false;
+    const auto seconds = std::strtoull(p, &end, 10);
+    if (end == p || *end != '.')
+        return false;
+    p = end + 1;
+    std::uint64_t fraction = 0;
+    int digits = 0;
+    for (; *p >= '0' && *p <= '9'; ++p, ++digits) {
+        if (digits < 9)
+            fraction = fraction * 10 + static_cast<std::uint64_t>(*p - '0');
+    }
+    for (; digits < 9; ++digits) {
+        fraction *= 10;
+    }
+    if (*p++ != ')' || *p++ != ' ')
+        return false;
+    record.timestamp = seconds * 1000000000u + fraction;
+
+    // Interface
+    const char* name = p;
+    while (*p && *p != ' ')
+        ++p;
+    if (p == name || *p != ' ')
+        return false;
+    interface.assign(name, p++);
+
+    // CAN ID; three digits for standard frames, eight otherwise
+    std::memset(&record.frame, 0, sizeof(record.frame));
+    record.fd = false;
+    const char* id = p;
+    canid_t value = 0;
+    for (int digit; (digit = hexDigit(*p)) >= 0; ++p) {
+        value = (value << 4) | static_cast<canid_t>(digit);
+    }
+    if (*p++ != '#')
+        return false;
+    if (p - id == 9)
+        record.frame.can_id = (value & CAN_ERR_FLAG) ? value : (value | CAN_EFF_FLAG);
+    else if (p - id == 4)
+        record.frame.can_id = value;
+    else
+        return false;
+
+    std::size_t maxLength = CAN_MAX_DLEN;
+    if ('#' == *p) {
+        const int flags = hexDigit(p[1]);
+        if (flags < 0)
+            return false;
+        record.fd = true;
+        record.frame.flags = static_cast<std::uint8_t>(flags);
+        maxLength = CANFD_MAX_DLEN;
+        p += 2;
+    } else if ('R' == *p) {
+        record.frame.can_id |= CAN_RTR_FLAG;
+        const int length = hexDigit(p[1]);
+        record.frame.len = (length >= 0 && length <= CAN_MAX_DLEN)
+            ? static_cast<std::uint8_t>(length) : 0;
+        return true;
+    }
+
+    for (int high, low; (high = hexDigit(p[0])) >= 0 &&
+                        (low = hexDigit(p[1])) >= 0; p += 2) {
+        if (record.frame.len == maxLength)
+            return false;
+        record.frame.data[record.frame.len++] =
+            static_cast<std::uint8_t>((high << 4) | low);
+    }
+
+    return true;
+}
+
+void formatLogLine(const Record& record, std::string& out) {
+    const canid_t id = record.frame.can_id;
+    char text[64];
+
+    std::snprintf(text, sizeof(text), "(%010" PRIu64 ".%06" PRIu64 ") %s ",
+                  record.timestamp / 1000000000u,
+                  record.timestamp % 1000000000u / 1000u,
+                  record.interface);
+    out += text;
+
+    if (id & CAN_ERR_FLAG)
+        std::snprintf(text, sizeof(text), "%08X#", id & (CAN_ERR_MASK | CAN_ERR_FLAG));
+    else if (id & CAN_EFF_FLAG)
+        std::snprintf(text, sizeof(text), "%08X#", id & CAN_EFF_MASK);
+    else
+        std::snprintf(text, sizeof(text), "%03X#", id & CAN_SFF_MASK);
+    out += text;
+
+    if (record.fd) {
+        out += '#';
+        out += kHex[record.frame.flags & 0x0F];
+    } else if (id & CAN_RTR_FLAG) {
+        out += 'R';
+        if (record.frame.len > 0)
+            out += kHex[record.frame.len & 0x0F];
+        out += '\n';
+        return;
+    }
+
+    for (std::size_t i = 0; i < record.frame.len; ++i) {
+        out += kHex[record.frame.data[i] >> 4];
+        out += kHex[record.frame.data[i] & 0x0F];
+    }
+    out += '\n';
+}
+
+Writer::Writer(std::size_t blockRecords)
+    : file_(nullptr)
+    , blockRecords_(blockRecords > 0 ? blockRecords : kBlockRecords)
+    , bytesWritten_(0)
+{
+    pending_.reserve(blockRecords_);
+}
+
+Writer::~Writer() {
+    close();
+}
+
+bool Writer::open(const char* path) {
+    std::uint8_t header[8];
+
+    file_ = std::fopen(path, "wb");
+    if (!file_) {
+        std::perror(path);
+        return false;
+    }
+
+    putLe32(header, kFileMagic);
+    putLe32(header + 4, kVersion);
+    if (std::fwrite(header, sizeof(header), 1, file_) != 1) {
+        std::perror(path);
+        std::fclose(file_);
+        file_ = nullptr;
+        return false;
+    }
+
+    bytesWritten_ = sizeof(header);
+    return true;
+}
+
+bool Writer::add(const Record& record) {
+    Pending entry;
+
+    // A trace only ever sees a handful of interfaces
+    auto it = std::find(interfaces_.begin(), interfaces_.end(), record.interface);
+    if (it == interfaces_.end())
+        it = interfaces_.insert(interfaces_.end(), record.interface);
+
+    entry.timestamp = record.timestamp;
+    entry.interface = static_cast<std::uint32_t>(it - interfaces_.begin());
+    entry.fd = record.fd;
+    entry.frame = record.frame;
+    pending_.push_back(entry);
+
+    if (pending_.size() < blockRecords_)
+        return true;
+
+    return flush();
+}
+
+bool Writer::close() {
+    if (!file_)
+        return true;
+
+    bool ok = flush();
+    if (std::fclose(file_) != 0) {
+        std::perror("fclose archive");
+        ok = false;
+    }
+
+    file_ = nullptr;
+    return ok;
+}
+
+bool Writer::flush() {
+    std::vector<std::uint8_t> dictionary, keys, times, masks, bytes;
+    std::unordered_map<std::uint64_t, std::uint32_t> indices;
+    std::vector<KeyState> states;
+    BlockHeader header;
+
+    if (pending_.empty())
+        return true;
+
+    // Time range, and the largest unit dividing every timestamp
+    header.count = static_cast<std::uint32_t>(pending_.size());
+    header.minTime = UINT64_MAX;
+    header.maxTime = 0;
+    for (const auto& entry : pending_) {
+        header.minTime = std::min(header.minTime, entry.timestamp);
+        header.maxTime = std::max(header.maxTime, entry.timestamp);
+    }
+    std::uint64_t unit = 0;
+    for (const auto& entry : pending_) {
+        std::uint64_t a = entry.timestamp - header.minTime;
+        while (a != 0) {
+            const auto b = unit % a;
+            unit = a;
+            a = b;
+        }
+    }
+    header.unit = unit ? unit : 1;
+    std::memset(header.bitmap, 0, sizeof(header.bitmap));
+
+    std::int64_t previous = 0;
+    for (const auto& entry : pending_) {
+        const auto& frame = entry.frame;
+        const std::uint8_t flags = entry.fd
+            ? static_cast<std::uint8_t>(kFdKey | (frame.flags & ~kFdKey)) : 0;
+        const std::uint64_t key = (static_cast<std::uint64_t>(entry.interface) << 48) |
+                                  (static_cast<std::uint64_t>(frame.can_id) << 16) |
+                                  (static_cast<std::uint64_t>(frame.len) << 8) |
+                                  flags;
+
+        // Dictionary
+        auto inserted = indices.emplace(key, static_cast<std::uint32_t>(states.size()));
+        if (inserted.second) {
+            putVarint(dictionary, entry.interface);
+            putVarint(dictionary, frame.can_id);
+            dictionary.push_back(frame.len);
+            dictionary.push_back(flags);
+            states.push_back(KeyState());
+            std::memset(&states.back(), 0, sizeof(KeyState));
+
+            const auto bit = bitmapIndex(frame.can_id);
+            header.bitmap[bit / 64] |= std::uint64_t(1) << (bit % 64);
+        }
+        const auto index = inserted.first->second;
+        KeyState& state = states[index];
+
+        // Payload, with one mask byte per eight bytes of the XOR
+        std::uint8_t recordMasks[CANFD_MAX_DLEN / 8];
+        const std::size_t chunks = (frame.len + 7u) / 8u;
+        for (std::size_t chunk = 0; chunk < chunks; ++chunk) {
+            const std::size_t base = chunk * 8;
+            const std::size_t n = std::min<std::size_t>(8, frame.len - base);
+            std::uint8_t mask = 0;
+
+            for (std::size_t i = 0; i < n; ++i) {
+                const std::uint8_t x = frame.data[base + i] ^ state.payload[base + i];
+                if (x) {
+                    mask |= static_cast<std::uint8_t>(1u << i);
+                    bytes.push_back(x);
+                }
+            }
+            recordMasks[chunk] = mask;
+        }
+        std::memcpy(state.payload, frame.data, frame.len);
+
+        // The low bit of the key marks masks repeating those of the last frame
+        const bool sameMasks = 0 == std::memcmp(recordMasks, state.masks, chunks);
+        putVarint(keys, (static_cast<std::uint64_t>(index) << 1) | sameMasks);
+        if (!sameMasks) {
+            masks.insert(masks.end(), recordMasks, recordMasks + chunks);
+            std::memcpy(state.masks, recordMasks, chunks);
+        }
+
+        // Timestamp, relative to the previous frame until the key repeats
+        const auto now = static_cast<std::int64_t>(
+            (entry.timestamp - header.minTime) / header.unit);
+        if (state.seen) {
+            const auto delta = now - state.last;
+            putVarint(times, zigzag(delta - state.delta));
+            state.delta = delta;
+        } else {
+            putVarint(times, zigzag(now - previous));
+            state.seen = true;
+        }
+        state.last = now;
+        previous = now;
+    }
+
+    // Body
+    body_.clear();
+    putVarint(body_, interfaces_.size());
+    for (const auto& name : interfaces_) {
+        putVarint(body_, name.size());
+        body_.insert(body_.end(), name.begin(), name.end());
+    }
+    putVarint(body_, states.size());
+    appendColumn(body_, dictionary);
+    appendColumn(body_, keys);
+    appendColumn(body_, times);
+    appendColumn(body_, masks);
+    appendColumn(body_, bytes);
+    header.bodySize = static_cast<std::uint32_t>(body_.size());
+
+    // Header
+    std::uint8_t raw[kHeaderSize];
+    putLe32(raw, kBlockMagic);
+    putLe32(raw + 4, header.count);
+    putLe64(raw + 8, header.minTime);
+    putLe64(raw + 16, header.maxTime);
+    putLe64(raw + 24, header.unit);
+    putLe32(raw + 32, header.bodySize);
+    putLe32(raw + 36, 0);
+    for (std::size_t i = 0; i < kBitmapWords; ++i) {
+        putLe64(raw + 40 + 8 * i, header.bitmap[i]);
+    }
+
+    pending_.clear();
+
+    if (std::fwrite(raw, sizeof(raw), 1, file_) != 1 ||
+        std::fwrite(body_.data(), body_.size(), 1, file_) != 1) {
+        std::perror("fwrite archive");
+        return false;
+    }
+
+    bytesWritten_ += sizeof(raw) + body_.size();
+    return true;
+}
+
+Reader::Reader()
+    : file_(nullptr)
+    , blocksDecoded_(0)
+    , blocksSkipped_(0)
+{
+}
+
+Reader::~Reader() {
+    close();
+}
+
+bool Reader::open(const char* path) {
+    std::uint8_t header[8];
+
+    file_ = std::fopen(path, "rb");
+    if (!file_) {
+        std::perror(path);
+        return false;
+    }
+
+    if (std::fread(header, sizeof(header), 1, file_) != 1 ||
+        getLe32(header) != kFileMagic || getLe32(header + 4) != kVersion) {
+        std::fprintf(stderr, "%s: not a version %u archive\n", path, kVersion);
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void Reader::close() {
+    if (file_)
+        std::fclose(file_);
+    file_ = nullptr;
+}
+
+bool Reader::query(const Query& query, const Visitor& visit) {
+    std::uint64_t wanted[kBitmapWords] = {};
+    std::uint8_t raw[kHeaderSize];
+
+    for (const auto id : query.ids) {
+        const auto bit = bitmapIndex(id);
+        wanted[bit / 64] |= std::uint64_t(1) << (bit % 64);
+    }
+
+    // Rewind to the first block
+    if (std::fseek(file_, 8, SEEK_SET) != 0) {
+        std::perror("fseek archive");
+        return false;
+    }
+
+    while (std::fread(raw, sizeof(raw), 1, file_) == 1) {
+        if (getLe32(raw) != kBlockMagic) {
+            std::fprintf(stderr, "Corrupt archive block header\n");
+            return false;
+        }
+
+        const auto count = getLe32(raw + 4);
+        const auto minTime = getLe64(raw + 8);
+        const auto maxTime = getLe64(raw + 16);
+        const auto unit = getLe64(raw + 24);
+        const auto bodySize = getLe32(raw + 32);
+
+        bool match = maxTime >= query.from && minTime <= query.to;
+        if (match && !query.ids.empty()) {
+            match = false;
+            for (std::size_t i = 0; i < kBitmapWords; ++i) {
+                if (getLe64(raw + 40 + 8 * i) & wanted[i])
+                    match = true;
+            }
+        }
+
+        if (!match) {
+            ++blocksSkipped_;
+            if (::fseeko(file_, bodySize, SEEK_CUR) != 0) {
+                std::perror("fseek archive");
+                return false;
+            }
+            continue;
+        }
+
+        body_.resize(bodySize);
+        if (std::fread(body_.data(), bodySize, 1, file_) != 1) {
+            std::fprintf(stderr, "Truncated archive block\n");
+            return false;
+        }
+
+        ++blocksDecoded_;
+        if (!decode(query, count, minTime, unit, visit)) {
+            std::fprintf(stderr, "Corrupt archive block\n");
+            return false;
+        }
+    }
+
+    if (std::ferror(file_)) {
+        std::perror("fread archive");
+        return false;
+    }
+
+    return true;
+}
+
+bool Reader::decode(const Query& query, std::uint32_t count,
+                    std::uint64_t minTime, std::uint64_t unit,
+                    const Visitor& visit) {
+    struct Key {
+        std::uint32_t interface;
+        canid_t id;
+        std::uint8_t len;
+        std::uint8_t flags;
+        bool match;
+    };
+
+    Cursor in = { body_.data(), body_.data() + body_.size() };
+    Cursor dictionary, keys, times, masks, bytes;
+    std::vector<std::string> interfaces;
+    std::vector<KeyState> states;
+    std::vector<Key> dict;
+    std::uint64_t n, value;
+    Record record;
+
+    // Interface names
+    if (!in.varint(n) || n > body_.size())
+        return false;
+    interfaces.resize(n);
+    for (auto& name : interfaces) {
+        if (!in.varint(value) || value > static_cast<std::uint64_t>(in.end - in.p))
+            return false;
+        name.assign(reinterpret_cast<const char*>(in.p), value);
+        in.p += value;
+    }
+
+    // Columns
+    if (!in.varint(n) || n > body_.size() ||
+        !in.column(dictionary) || !in.column(keys) || !in.column(times) ||
+        !in.column(masks) || !in.column(bytes))
+        return false;
+
+    dict.resize(n);
+    states.resize(n);
+    for (auto& key : dict) {
+        if (!dictionary.varint(value) || value >= interfaces.size())
+            return false;
+        key.interface = static_cast<std::uint32_t>(value);
+        if (!dictionary.varint(value) || value > UINT32_MAX)
+            return false;
+        key.id = static_cast<canid_t>(value);
+        if (!dictionary.byte(key.len) || !dictionary.byte(key.flags))
+            return false;
+        if (key.len > ((key.flags & kFdKey) ? CANFD_MAX_DLEN : CAN_MAX_DLEN))
+            return false;
+
+        key.match = query.ids.empty();
+        for (const auto id : query.ids) {
+            if (matchId(id) == matchId(key.id))
+                key.match = true;
+        }
+    }
+    for (auto& state : states) {
+        std::memset(&state, 0, sizeof(state));
+    }
+
+    std::memset(&record.frame, 0, sizeof(record.frame));
+    std::int64_t previous = 0;
+    for (std::uint32_t i = 0; i < count; ++i) {
+        if (!keys.varint(value) || (value >> 1) >= dict.size())
+            return false;
+        const bool sameMasks = value & 1;
+        const Key& key = dict[value >> 1];
+        KeyState& state = states[value >> 1];
+
+        // Payload; every record is decoded to keep the XOR chains intact
+        const std::size_t chunks = (key.len + 7u) / 8u;
+        for (std::size_t chunk = 0; chunk < chunks; ++chunk) {
+            if (!sameMasks && !masks.byte(state.masks[chunk]))
+                return false;
+
+            std::uint8_t* payload = state.payload + chunk * 8;
+            for (std::uint8_t mask = state.masks[chunk]; mask;
+                 mask &= static_cast<std::uint8_t>(mask - 1)) {
+                std::uint8_t x;
+                if (!bytes.byte(x))
+                    return false;
+                payload[__builtin_ctz(mask)] ^= x;
+            }
+        }
+
+        // Timestamp
+        if (!times.varint(value))
+            return false;
+        std::int64_t now;
+        if (state.seen) {
+            state.delta += unzigzag(value);
+            now = state.last + state.delta;
+        } else {
+            now = previous + unzigzag(value);
+            state.seen = true;
+        }
+        state.last = now;
+        previous = now;
+
+        if (!key.match)
+            continue;
+
+        record.timestamp = minTime + static_cast<std::uint64_t>(now) * unit;
+        if (record.timestamp < query.from || record.timestamp > query.to)
+            continue;
+
+        record.interface = interfaces[key.interface].c_str();
+        record.fd = (key.flags & kFdKey) != 0;
+        record.frame.can_id = key.id;
+        record.frame.len = key.len;
+        record.frame.flags = static_cast<std::uint8_t>(key.flags & ~kFdKey);
+        std::memcpy(record.frame.data, state.payload, key.len);
+        visit(record);
+    }
+
+    return true;
+}
+
+} // namespace archive
@@ -0,0 +1,146 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015, 2016 Jacob McGladdery
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+-------------------------------------------------------------------------------
+
+CAN Trace Archive
+
+A compact file format for long-term trace storage. Frames are grouped into
+self-contained blocks and every block stores its records column by column:
+
+ - A dictionary of the distinct (interface, ID, length, flags) keys, and one
+   key index per record.
+ - Timestamps as the zigzag varint delta-of-delta against the previous frame
+   with the same key, in the largest unit dividing every timestamp.
+ - Payloads XORed against the previous payload with the same key; a bit mask
+   marks the nonzero bytes and only those are stored. A flag in the key index
+   elides the masks when they repeat those of the previous frame.
+
+Each block header carries the time range and a 2048 bit ID bitmap, so queries
+seek over the blocks which cannot match without decoding them. Header fields
+are little endian.
+*/
+
+#ifndef _CAN_ARCHIVE_H_
+#define _CAN_ARCHIVE_H_
+
+#include <linux/can.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+namespace archive {
+
+constexpr std::size_t kBlockRecords = 4096;
+constexpr std::size_t kBitmapWords = 32; // 2048 bits
+
+struct Record {
+    std::uint64_t timestamp; // Nanoseconds
+    const char* interface;
+    bool fd;
+    struct canfd_frame frame;
+};
+
+struct Query {
+    std::uint64_t from = 0;
+    std::uint64_t to = UINT64_MAX;
+    std::vector<canid_t> ids; // Empty matches every ID
+};
+
+// Bit of the block ID bitmap; standard IDs map one to one
+unsigned int bitmapIndex(canid_t id);
+
+// candump log file lines, "(seconds.micros) interface ID#DATA"
+bool parseLogLine(const std::string& line, std::string& interface,
+                  Record& record);
+void formatLogLine(const Record& record, std::string& out);
+
+class Writer {
+public:
+    explicit Writer(std::size_t blockRecords = kBlockRecords);
+    ~Writer();
+
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+
+    bool open(const char* path);
+    bool add(const Record& record);
+    bool close(); // Flushes the last partial block
+
+    std::uint64_t bytesWritten() const { return bytesWritten_; }
+
+private:
+    struct Pending {
+        std::uint64_t timestamp;
+        std::uint32_t interface; // Index into interfaces_
+        bool fd;
+        struct canfd_frame frame;
+    };
+
+    bool flush();
+
+    std::FILE* file_;
+    std::size_t blockRecords_;
+    std::uint64_t bytesWritten_;
+    std::vector<std::string> interfaces_;
+    std::vector<Pending> pending_;
+    std::vector<std::uint8_t> body_;
+};
+
+class Reader {
+public:
+    using Visitor = std::function<void(const Record&)>;
+
+    Reader();
+    ~Reader();
+
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    bool open(const char* path);
+    void close();
+
+    // Visits the matching records in file order; false on I/O or format errors
+    bool query(const Query& query, const Visitor& visit);
+
+    std::uint64_t blocksDecoded() const { return blocksDecoded_; }
+    std::uint64_t blocksSkipped() const { return blocksSkipped_; }
+
+private:
+    bool decode(const Query& query, std::uint32_t count,
+                std::uint64_t minTime, std::uint64_t unit, const Visitor& visit);
+
+    std::FILE* file_;
+    std::uint64_t blocksDecoded_;
+    std::uint64_t blocksSkipped_;
+    std::vector<std::uint8_t> body_;
+};
+
+} // namespace archive
+
+#endif /* _CAN_ARCHIVE_H_ */
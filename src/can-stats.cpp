@@ -0,0 +1,345 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015, 2016 Jacob McGladdery
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "can-stats.h"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+namespace stats {
+
+namespace {
+
+// Weight of a new sample in the moving average is 1/2^kEwmaShift
+constexpr int kEwmaShift = 3;
+
+// How often the exporter thread checks whether it should stop
+constexpr int kPollTimeout = 200;
+
+using Getter = std::uint64_t (*)(const Counters&);
+
+// Only the receive loop writes, so a read-modify-write needs no atomic RMW
+inline void add(std::atomic<std::uint64_t>& counter, std::uint64_t n) {
+    counter.store(counter.load(std::memory_order_relaxed) + n,
+                  std::memory_order_relaxed);
+}
+
+inline std::uint64_t get(const std::atomic<std::uint64_t>& counter) {
+    return counter.load(std::memory_order_relaxed);
+}
+
+// Labels follow the ID, such as ",frame=\"xl\"", or are empty
+void formatCounter(std::string& out, const char* name, const Counters& c,
+                   const char* labels, std::uint64_t value, double scale) {
+    const canid_t id = c.id.load(std::memory_order_relaxed);
+    const int width = (id & CAN_EFF_FLAG) ? 8 : 3;
+    char line[128];
+
+    if (scale != 1.0) {
+        std::snprintf(line, sizeof(line), "%s{id=\"%0*X\"%s} %.9f\n",
+                      name, width, id & CAN_EFF_MASK, labels, value * scale);
+    } else {
+        std::snprintf(line, sizeof(line), "%s{id=\"%0*X\"%s} %" PRIu64 "\n",
+                      name, width, id & CAN_EFF_MASK, labels, value);
+    }
+    out += line;
+}
+
+} // namespace
+
+Table::Table()
+    : standard_()
+    , extended_()
+    , xl_()
+    , overflow_(0)
+{
+    // Standard ID and CAN XL priority slots are keyed by their index
+    for (canid_t id = 0; id <= CAN_SFF_MASK; ++id) {
+        standard_[id].id.store(id, std::memory_order_relaxed);
+    }
+
+    for (canid_t id = 0; id <= CANXL_PRIO_MASK; ++id) {
+        xl_[id].id.store(id, std::memory_order_relaxed);
+    }
+}
+
+Counters* Table::lookup(canid_t id) {
+    if (!(id & CAN_EFF_FLAG))
+        return &standard_[id & CAN_SFF_MASK];
+
+    // Fibonacci hashing with linear probing
+    const canid_t key = id & (CAN_EFF_FLAG | CAN_EFF_MASK);
+    std::size_t index = (key * 2654435761u) >> (32 - kExtendedBits);
+
+    for (std::size_t probe = 0; probe < kExtendedSlots; ++probe) {
+        Counters& c = extended_[index];
+        const canid_t current = c.id.load(std::memory_order_relaxed);
+
+        if (current == key)
+            return &c;
+
+        if (0 == current) {
+            c.id.store(key, std::memory_order_release);
+            return &c;
+        }
+
+        index = (index + 1) % kExtendedSlots;
+    }
+
+    return nullptr;
+}
+
+void Table::record(canid_t id, std::uint16_t length, std::uint64_t timestamp) {
+    Counters* c = lookup(id);
+    if (!c) {
+        add(overflow_, 1);
+        return;
+    }
+
+    update(c, length, timestamp);
+}
+
+void Table::unexpected(canid_t id) {
+    Counters* c = lookup(id);
+    if (c)
+        add(c->unexpected, 1);
+    else
+        add(overflow_, 1);
+}
+
+void Table::recordXl(canid_t priority, std::uint16_t length,
+                     std::uint64_t timestamp) {
+    update(&xl_[priority & CANXL_PRIO_MASK], length, timestamp);
+}
+
+void Table::unexpectedXl(canid_t priority) {
+    add(xl_[priority & CANXL_PRIO_MASK].unexpected, 1);
+}
+
+void Table::update(Counters* c, std::uint16_t length, std::uint64_t timestamp) {
+    const auto frames = get(c->frames);
+    if (frames > 0) {
+        const auto gap = timestamp - get(c->lastArrival);
+
+        if (1 == frames || gap < get(c->minGap))
+            c->minGap.store(gap, std::memory_order_relaxed);
+        if (gap > get(c->maxGap))
+            c->maxGap.store(gap, std::memory_order_relaxed);
+
+        // Integer EWMA, seeded with the first gap
+        const auto ewma = static_cast<std::int64_t>(get(c->ewmaGap));
+        const auto next = (1 == frames)
+            ? static_cast<std::int64_t>(gap)
+            : ewma + ((static_cast<std::int64_t>(gap) - ewma) >> kEwmaShift);
+        c->ewmaGap.store(static_cast<std::uint64_t>(next),
+                         std::memory_order_relaxed);
+
+        if (length != c->lastLength.load(std::memory_order_relaxed))
+            add(c->lengthChanges, 1);
+    }
+
+    c->lastLength.store(length, std::memory_order_relaxed);
+    c->lastArrival.store(timestamp, std::memory_order_relaxed);
+    add(c->bytes, length);
+    c->frames.store(frames + 1, std::memory_order_relaxed);
+}
+
+void Table::format(std::string& out) const {
+    struct Family {
+        const char* name;
+        const char* type;
+        Getter getter;
+        double scale;
+    };
+
+    static const Family families[] = {
+        { "can_frames_total", "counter",
+          [](const Counters& c) { return get(c.frames); }, 1.0 },
+        { "can_bytes_total", "counter",
+          [](const Counters& c) { return get(c.bytes); }, 1.0 },
+        { "can_interarrival_min_seconds", "gauge",
+          [](const Counters& c) { return get(c.minGap); }, 1e-9 },
+        { "can_interarrival_max_seconds", "gauge",
+          [](const Counters& c) { return get(c.maxGap); }, 1e-9 },
+        { "can_interarrival_ewma_seconds", "gauge",
+          [](const Counters& c) { return get(c.ewmaGap); }, 1e-9 },
+        { "can_length_changes_total", "counter",
+          [](const Counters& c) { return get(c.lengthChanges); }, 1.0 },
+        { "can_unexpected_total", "counter",
+          [](const Counters& c) { return get(c.unexpected); }, 1.0 },
+    };
+
+    for (const auto& family : families) {
+        out += "# TYPE ";
+        out += family.name;
+        out += ' ';
+        out += family.type;
+        out += '\n';
+
+        // IDs which were never seen are left out
+        for (const auto& c : standard_) {
+            if (get(c.frames) > 0 || get(c.unexpected) > 0)
+                formatCounter(out, family.name, c, "", family.getter(c),
+                              family.scale);
+        }
+
+        for (const auto& c : extended_) {
+            if (get(c.frames) > 0 || get(c.unexpected) > 0)
+                formatCounter(out, family.name, c, "", family.getter(c),
+                              family.scale);
+        }
+
+        for (const auto& c : xl_) {
+            if (get(c.frames) > 0 || get(c.unexpected) > 0)
+                formatCounter(out, family.name, c, ",frame=\"xl\"",
+                              family.getter(c), family.scale);
+        }
+    }
+
+    char line[96];
+    std::snprintf(line, sizeof(line),
+                  "# TYPE can_stats_overflow_total counter\n"
+                  "can_stats_overflow_total %" PRIu64 "\n",
+                  get(overflow_));
+    out += line;
+}
+
+Exporter::Exporter(const Table& table)
+    : table_(table)
+    , device_(0)
+    , inode_(0)
+    , listenfd_(-1)
+    , running_(false)
+{
+}
+
+Exporter::~Exporter() {
+    stop();
+}
+
+bool Exporter::start(const char* path) {
+    struct sockaddr_un addr;
+
+    if (std::strlen(path) >= sizeof(addr.sun_path)) {
+        std::fprintf(stderr, "%s: socket path too long\n", path);
+        return false;
+    }
+
+    // Replace a socket left behind by a previous run, but nothing else
+    struct stat st;
+    if (::lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            std::fprintf(stderr, "%s: exists and is not a socket\n", path);
+            return false;
+        }
+        ::unlink(path);
+    }
+
+    listenfd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (-1 == listenfd_) {
+        std::perror("socket telemetry");
+        return false;
+    }
+
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (::bind(listenfd_, reinterpret_cast<struct sockaddr*>(&addr),
+               sizeof(addr)) == -1 ||
+        ::listen(listenfd_, 4) == -1) {
+        std::perror("bind telemetry");
+        ::close(listenfd_);
+        listenfd_ = -1;
+        return false;
+    }
+
+    if (::lstat(path, &st) == 0) {
+        device_ = st.st_dev;
+        inode_ = st.st_ino;
+    }
+
+    path_ = path;
+    running_.store(true);
+    thread_ = std::thread(&Exporter::run, this);
+    return true;
+}
+
+void Exporter::stop() {
+    if (!running_.exchange(false))
+        return;
+
+    thread_.join();
+    ::close(listenfd_);
+    listenfd_ = -1;
+
+    // Another process may have replaced the socket in the meantime
+    struct stat st;
+    if (::lstat(path_.c_str(), &st) == 0 && S_ISSOCK(st.st_mode) &&
+        st.st_dev == device_ && st.st_ino == inode_)
+        ::unlink(path_.c_str());
+}
+
+void Exporter::run() {
+    std::string out;
+
+    while (running_.load()) {
+        struct pollfd fd = { listenfd_, POLLIN, 0 };
+
+        if (::poll(&fd, 1, kPollTimeout) <= 0)
+            continue;
+
+        int clientfd = ::accept4(listenfd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (-1 == clientfd)
+            continue;
+
+        // One scrape per connection
+        out.clear();
+        table_.format(out);
+
+        const char* data = out.data();
+        std::size_t remaining = out.size();
+        while (remaining > 0) {
+            auto numBytes = ::send(clientfd, data, remaining, MSG_NOSIGNAL);
+            if (numBytes <= 0) {
+                if (-1 == numBytes && EINTR == errno)
+                    continue;
+                break;
+            }
+            data += numBytes;
+            remaining -= static_cast<std::size_t>(numBytes);
+        }
+
+        ::close(clientfd);
+    }
+}
+
+} // namespace stats
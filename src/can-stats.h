@@ -0,0 +1,124 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015, 2016 Jacob McGladdery
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+-------------------------------------------------------------------------------
+
+Per-ID CAN Statistics
+
+Counters for every CAN ID seen by a service. Standard IDs index a flat array
+directly and extended IDs live in a fixed-size open addressing table. CAN XL
+priority IDs share the 11 bit range with standard IDs, so they index a flat
+array of their own and are exported with a frame="xl" label. There is
+a single writer, the receive loop, which only uses relaxed loads and stores.
+The exporter thread reads the same counters without taking any lock and
+serves them in the Prometheus text format on a Unix domain socket.
+*/
+
+#ifndef _CAN_STATS_H_
+#define _CAN_STATS_H_
+
+#include <linux/can.h>
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace stats {
+
+// Capacity of the extended ID table
+constexpr unsigned int kExtendedBits = 10;
+constexpr std::size_t kExtendedSlots = 1u << kExtendedBits;
+
+struct Counters {
+    std::atomic<canid_t> id; // Zero marks an unused extended ID slot
+    std::atomic<std::uint16_t> lastLength;
+    std::atomic<std::uint64_t> frames;
+    std::atomic<std::uint64_t> bytes;
+    std::atomic<std::uint64_t> lastArrival; // Nanoseconds
+    std::atomic<std::uint64_t> minGap;
+    std::atomic<std::uint64_t> maxGap;
+    std::atomic<std::uint64_t> ewmaGap;
+    std::atomic<std::uint64_t> lengthChanges;
+    std::atomic<std::uint64_t> unexpected;
+};
+
+class Table {
+public:
+    Table();
+
+    Table(const Table&) = delete;
+    Table& operator=(const Table&) = delete;
+
+    // Writer side, called from the receive loop only
+    void record(canid_t id, std::uint16_t length, std::uint64_t timestamp);
+    void unexpected(canid_t id);
+
+    // CAN XL frames, keyed by their priority ID
+    void recordXl(canid_t priority, std::uint16_t length, std::uint64_t timestamp);
+    void unexpectedXl(canid_t priority);
+
+    // Reader side, safe to call from any thread
+    void format(std::string& out) const;
+
+private:
+    Counters* lookup(canid_t id);
+    void update(Counters* c, std::uint16_t length, std::uint64_t timestamp);
+
+    Counters standard_[CAN_SFF_MASK + 1];
+    Counters extended_[kExtendedSlots];
+    Counters xl_[CANXL_PRIO_MASK + 1];
+    std::atomic<std::uint64_t> overflow_; // Extended IDs which did not fit
+};
+
+// Serves a Table on a Unix domain socket from a background thread
+class Exporter {
+public:
+    explicit Exporter(const Table& table);
+    ~Exporter();
+
+    Exporter(const Exporter&) = delete;
+    Exporter& operator=(const Exporter&) = delete;
+
+    bool start(const char* path);
+    void stop();
+
+private:
+    void run();
+
+    const Table& table_;
+    std::string path_;
+    dev_t device_; // Identify the socket file we bound, to only remove that
+    ino_t inode_;
+    int listenfd_;
+    std::atomic<bool> running_;
+    std::thread thread_;
+};
+
+} // namespace stats
+
+#endif /* _CAN_STATS_H_ */
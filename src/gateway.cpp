@@ -0,0 +1,536 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015, 2016 Jacob McGladdery
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "gateway.h"
+
+#include <linux/can/gw.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include <net/if.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <sstream>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace gateway {
+
+namespace {
+
+constexpr std::size_t kMessageSize = 1024;
+
+const char* const kModNames[NumModOps] = { "and", "or", "xor", "set", "add" };
+
+const int kModAttributes[] = {
+    CGW_MOD_AND,
+    CGW_MOD_OR,
+    CGW_MOD_XOR,
+    CGW_MOD_SET
+};
+
+struct NetlinkMessage {
+    struct nlmsghdr header;
+    struct rtcanmsg rtcan;
+    char attributes[kMessageSize];
+};
+
+void addAttribute(NetlinkMessage& message, int type,
+                  const void* data, std::size_t length) {
+    struct nlmsghdr* const header = &message.header;
+    auto attribute = reinterpret_cast<struct rtattr*>(
+        reinterpret_cast<char*>(&message) + NLMSG_ALIGN(header->nlmsg_len));
+
+    attribute->rta_type = static_cast<unsigned short>(type);
+    attribute->rta_len = static_cast<unsigned short>(RTA_LENGTH(length));
+    std::memcpy(RTA_DATA(attribute), data, length);
+    header->nlmsg_len = NLMSG_ALIGN(header->nlmsg_len) + RTA_ALIGN(RTA_LENGTH(length));
+}
+
+void buildCrc8Table(std::uint8_t polynomial, std::uint8_t* table) {
+    for (unsigned int i = 0; i < 256; ++i) {
+        std::uint8_t crc = static_cast<std::uint8_t>(i);
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc & 0x80)
+                ? static_cast<std::uint8_t>((crc << 1) ^ polynomial)
+                : static_cast<std::uint8_t>(crc << 1);
+        }
+        table[i] = crc;
+    }
+}
+
+bool parseBytes(const std::string& text, std::uint8_t* data, std::size_t size) {
+    if (text.size() != 2 * size)
+        return false;
+
+    for (std::size_t i = 0; i < size; ++i) {
+        char* end;
+        const std::string byte = text.substr(2 * i, 2);
+        data[i] = static_cast<std::uint8_t>(std::strtoul(byte.c_str(), &end, 16));
+        if (*end != '\0')
+            return false;
+    }
+
+    return true;
+}
+
+// Parse OP:FIELD=VALUE, for example "set:id=0BC" or "and:data=FF00FF00FF00FF00"
+bool parseModification(const std::string& token, Route& route) {
+    const auto colon = token.find(':');
+    const auto equals = token.find('=');
+    if (colon == std::string::npos || equals == std::string::npos ||
+        equals < colon)
+        return false;
+
+    const std::string op = token.substr(0, colon);
+    const std::string field = token.substr(colon + 1, equals - colon - 1);
+    const std::string value = token.substr(equals + 1);
+
+    for (int i = 0; i < NumModOps; ++i) {
+        if (op != kModNames[i])
+            continue;
+
+        Modification& mod = route.mods[i];
+        char* end;
+
+        if (field == "id") {
+            mod.frame.can_id = static_cast<canid_t>(
+                std::strtoul(value.c_str(), &end, 16));
+            if (mod.frame.can_id > CAN_SFF_MASK)
+                mod.frame.can_id |= CAN_EFF_FLAG;
+            mod.fields |= CGW_MOD_ID;
+            return *end == '\0' && !value.empty();
+        }
+
+        if (field == "dlc") {
+            mod.frame.can_dlc = static_cast<std::uint8_t>(
+                std::strtoul(value.c_str(), &end, 16));
+            mod.fields |= CGW_MOD_DLC;
+            return *end == '\0' && !value.empty();
+        }
+
+        if (field == "data") {
+            mod.fields |= CGW_MOD_DATA;
+            return parseBytes(value, mod.frame.data, CAN_MAX_DLEN);
+        }
+
+        return false;
+    }
+
+    return false;
+}
+
+// Parse crc8:FROM,TO,RESULT[,POLY[,INIT[,XOR]]] with hex polynomial and values
+bool parseCrc8(const std::string& token, Route& route) {
+    unsigned int from, to, result;
+    unsigned int polynomial = 0x1D, init = 0x00, finalXor = 0x00;
+
+    const int n = std::sscanf(token.c_str(), "crc8:%u,%u,%u,%x,%x,%x",
+                              &from, &to, &result,
+                              &polynomial, &init, &finalXor);
+    if (n < 3 || from >= CAN_MAX_DLEN || to >= CAN_MAX_DLEN ||
+        result >= CAN_MAX_DLEN || polynomial > 0xFF || init > 0xFF ||
+        finalXor > 0xFF)
+        return false;
+
+    route.crc8.enabled = true;
+    route.crc8.fromIndex = static_cast<std::int8_t>(from);
+    route.crc8.toIndex = static_cast<std::int8_t>(to);
+    route.crc8.resultIndex = static_cast<std::int8_t>(result);
+    route.crc8.init = static_cast<std::uint8_t>(init);
+    route.crc8.finalXor = static_cast<std::uint8_t>(finalXor);
+    buildCrc8Table(static_cast<std::uint8_t>(polynomial), route.crc8.table);
+    return true;
+}
+
+// Parse ID[/MASK] in hex, matching only the frame format of the given ID
+bool parseFilter(const std::string& token, struct can_filter& filter) {
+    char* end;
+
+    filter.can_id = static_cast<canid_t>(std::strtoul(token.c_str(), &end, 16));
+    if (end == token.c_str())
+        return false;
+
+    if (filter.can_id > CAN_SFF_MASK) {
+        filter.can_id |= CAN_EFF_FLAG;
+        filter.can_mask = CAN_EFF_MASK;
+    } else {
+        filter.can_mask = CAN_SFF_MASK;
+    }
+
+    if (*end == '/') {
+        const char* mask = end + 1;
+        filter.can_mask = static_cast<canid_t>(std::strtoul(mask, &end, 16));
+        if (end == mask)
+            return false;
+    }
+
+    filter.can_mask |= CAN_EFF_FLAG;
+    return *end == '\0';
+}
+
+} // namespace
+
+bool parseRoutes(std::istream& in, std::vector<Route>& routes) {
+    std::string line;
+    unsigned int lineNumber = 0;
+
+    while (std::getline(in, line)) {
+        ++lineNumber;
+
+        // Strip comments
+        const auto hash = line.find('#');
+        if (hash != std::string::npos)
+            line.erase(hash);
+
+        std::istringstream tokens(line);
+        std::string filter;
+        Route route = Route();
+
+        if (!(tokens >> route.source))
+            continue;
+
+        if (!(tokens >> filter >> route.destination)) {
+            std::cerr << "line " << lineNumber
+                      << ": expected SOURCE FILTER DESTINATION" << std::endl;
+            return false;
+        }
+
+        if (!parseFilter(filter, route.filter)) {
+            std::cerr << "line " << lineNumber
+                      << ": invalid filter " << filter << std::endl;
+            return false;
+        }
+
+        for (std::string token; tokens >> token;) {
+            if ("coalesce" == token) {
+                route.coalesce = true;
+                continue;
+            }
+
+            const bool ok = (token.compare(0, 5, "crc8:") == 0)
+                ? parseCrc8(token, route)
+                : parseModification(token, route);
+            if (!ok) {
+                std::cerr << "line " << lineNumber
+                          << ": invalid modification " << token << std::endl;
+                return false;
+            }
+        }
+
+        route.sourceIndex = static_cast<int>(::if_nametoindex(route.source.c_str()));
+        route.destinationIndex = static_cast<int>(
+            ::if_nametoindex(route.destination.c_str()));
+        if (0 == route.sourceIndex || 0 == route.destinationIndex) {
+            std::cerr << "line " << lineNumber
+                      << ": unknown interface" << std::endl;
+            return false;
+        }
+
+        routes.push_back(route);
+    }
+
+    return true;
+}
+
+bool kernelExpressible(const Route& route) {
+    return 0 == route.mods[ModAdd].fields;
+}
+
+bool hasModifications(const Route& route) {
+    for (const auto& mod : route.mods) {
+        if (mod.fields)
+            return true;
+    }
+
+    return route.crc8.enabled;
+}
+
+bool matches(const Route& route, int ifindex, canid_t id) {
+    return route.sourceIndex == ifindex &&
+        ((id & route.filter.can_mask) ==
+         (route.filter.can_id & route.filter.can_mask));
+}
+
+bool applyModifications(const Route& route, struct can_frame& frame) {
+    std::uint64_t data;
+    std::memcpy(&data, frame.data, sizeof(data));
+
+    for (int i = 0; i < NumModOps; ++i) {
+        const Modification& mod = route.mods[i];
+        std::uint64_t modData;
+
+        if (0 == mod.fields)
+            continue;
+
+        std::memcpy(&modData, mod.frame.data, sizeof(modData));
+
+        switch (i) {
+        case ModAnd:
+            if (mod.fields & CGW_MOD_ID)   frame.can_id &= mod.frame.can_id;
+            if (mod.fields & CGW_MOD_DLC)  frame.can_dlc &= mod.frame.can_dlc;
+            if (mod.fields & CGW_MOD_DATA) data &= modData;
+            break;
+        case ModOr:
+            if (mod.fields & CGW_MOD_ID)   frame.can_id |= mod.frame.can_id;
+            if (mod.fields & CGW_MOD_DLC)  frame.can_dlc |= mod.frame.can_dlc;
+            if (mod.fields & CGW_MOD_DATA) data |= modData;
+            break;
+        case ModXor:
+            if (mod.fields & CGW_MOD_ID)   frame.can_id ^= mod.frame.can_id;
+            if (mod.fields & CGW_MOD_DLC)  frame.can_dlc ^= mod.frame.can_dlc;
+            if (mod.fields & CGW_MOD_DATA) data ^= modData;
+            break;
+        case ModSet:
+            if (mod.fields & CGW_MOD_ID)   frame.can_id = mod.frame.can_id;
+            if (mod.fields & CGW_MOD_DLC)  frame.can_dlc = mod.frame.can_dlc;
+            if (mod.fields & CGW_MOD_DATA) data = modData;
+            break;
+        case ModAdd:
+            if (mod.fields & CGW_MOD_ID)   frame.can_id += mod.frame.can_id;
+            if (mod.fields & CGW_MOD_DLC)  frame.can_dlc += mod.frame.can_dlc;
+            if (mod.fields & CGW_MOD_DATA) {
+                std::memcpy(frame.data, &data, sizeof(data));
+                for (std::size_t j = 0; j < CAN_MAX_DLEN; ++j) {
+                    frame.data[j] += mod.frame.data[j];
+                }
+                std::memcpy(&data, frame.data, sizeof(data));
+            }
+            break;
+        }
+    }
+
+    std::memcpy(frame.data, &data, sizeof(data));
+
+    // Like the kernel, drop frames which were given an invalid length
+    if (frame.can_dlc > CAN_MAX_DLEN)
+        return false;
+
+    if (route.crc8.enabled) {
+        const Crc8& crc8 = route.crc8;
+        const int step = (crc8.fromIndex <= crc8.toIndex) ? 1 : -1;
+        std::uint8_t crc = crc8.init;
+
+        for (int i = crc8.fromIndex; ; i += step) {
+            crc = crc8.table[crc ^ frame.data[i]];
+            if (i == crc8.toIndex)
+                break;
+        }
+
+        frame.data[crc8.resultIndex] = crc ^ crc8.finalXor;
+    }
+
+    return true;
+}
+
+Netlink::Netlink()
+    : sockfd_(-1)
+    , sequence_(0)
+{
+}
+
+Netlink::~Netlink() {
+    if (sockfd_ != -1)
+        ::close(sockfd_);
+}
+
+bool Netlink::open() {
+    sockfd_ = ::socket(PF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+    if (-1 == sockfd_) {
+        std::perror("socket netlink");
+        return false;
+    }
+
+    return true;
+}
+
+int Netlink::install(const Route& route) {
+    return request(RTM_NEWROUTE, route);
+}
+
+int Netlink::remove(const Route& route) {
+    return request(RTM_DELROUTE, route);
+}
+
+int Netlink::request(int type, const Route& route) {
+    NetlinkMessage message;
+    const std::uint32_t sourceIndex = route.sourceIndex;
+    const std::uint32_t destinationIndex = route.destinationIndex;
+
+    std::memset(&message, 0, sizeof(message));
+    message.header.nlmsg_len = NLMSG_LENGTH(sizeof(message.rtcan));
+    message.header.nlmsg_type = static_cast<std::uint16_t>(type);
+    message.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+    message.header.nlmsg_seq = ++sequence_;
+    message.rtcan.can_family = AF_CAN;
+    message.rtcan.gwtype = CGW_TYPE_CAN_CAN;
+
+    if (RTM_NEWROUTE == type) {
+        message.header.nlmsg_flags |= NLM_F_CREATE | NLM_F_EXCL;
+
+        for (int i = 0; i < ModAdd; ++i) {
+            struct cgw_frame_mod mod;
+
+            if (0 == route.mods[i].fields)
+                continue;
+
+            mod.cf = route.mods[i].frame;
+            mod.modtype = route.mods[i].fields;
+            addAttribute(message, kModAttributes[i], &mod, sizeof(mod));
+        }
+
+        if (route.crc8.enabled) {
+            struct cgw_csum_crc8 crc8;
+
+            std::memset(&crc8, 0, sizeof(crc8));
+            crc8.from_idx = route.crc8.fromIndex;
+            crc8.to_idx = route.crc8.toIndex;
+            crc8.result_idx = route.crc8.resultIndex;
+            crc8.init_crc_val = route.crc8.init;
+            crc8.final_xor_val = route.crc8.finalXor;
+            std::memcpy(crc8.crctab, route.crc8.table, sizeof(crc8.crctab));
+            crc8.profile = CGW_CRC8PRF_UNSPEC;
+            addAttribute(message, CGW_CS_CRC8, &crc8, sizeof(crc8));
+        }
+
+        addAttribute(message, CGW_FILTER,
+                     &route.filter, sizeof(route.filter));
+    }
+
+    // The UID identifies our rule again when deleting it and reading counters
+    addAttribute(message, CGW_MOD_UID, &route.uid, sizeof(route.uid));
+    addAttribute(message, CGW_SRC_IF, &sourceIndex, sizeof(sourceIndex));
+    addAttribute(message, CGW_DST_IF,
+                 &destinationIndex, sizeof(destinationIndex));
+
+    if (::send(sockfd_, &message, message.header.nlmsg_len, 0) == -1)
+        return errno;
+
+    return acknowledge();
+}
+
+int Netlink::acknowledge() {
+    char buffer[kMessageSize];
+
+    for (;;) {
+        auto numBytes = ::recv(sockfd_, buffer, sizeof(buffer), 0);
+        if (-1 == numBytes) {
+            if (EINTR == errno)
+                continue;
+            return errno;
+        }
+
+        auto header = reinterpret_cast<struct nlmsghdr*>(buffer);
+        auto length = static_cast<unsigned int>(numBytes);
+        for (; NLMSG_OK(header, length); header = NLMSG_NEXT(header, length)) {
+            if (header->nlmsg_seq != sequence_ || header->nlmsg_type != NLMSG_ERROR)
+                continue;
+
+            auto error = static_cast<struct nlmsgerr*>(NLMSG_DATA(header));
+            return -error->error;
+        }
+    }
+}
+
+bool Netlink::updateCounters(std::vector<Route>& routes) {
+    struct {
+        struct nlmsghdr header;
+        struct rtcanmsg rtcan;
+    } message;
+    char buffer[8192];
+
+    std::memset(&message, 0, sizeof(message));
+    message.header.nlmsg_len = NLMSG_LENGTH(sizeof(message.rtcan));
+    message.header.nlmsg_type = RTM_GETROUTE;
+    message.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    message.header.nlmsg_seq = ++sequence_;
+    message.rtcan.can_family = AF_CAN;
+
+    if (::send(sockfd_, &message, message.header.nlmsg_len, 0) == -1) {
+        std::perror("send netlink");
+        return false;
+    }
+
+    for (;;) {
+        auto numBytes = ::recv(sockfd_, buffer, sizeof(buffer), 0);
+        if (-1 == numBytes) {
+            if (EINTR == errno)
+                continue;
+            std::perror("recv netlink");
+            return false;
+        }
+
+        auto header = reinterpret_cast<struct nlmsghdr*>(buffer);
+        auto length = static_cast<unsigned int>(numBytes);
+        for (; NLMSG_OK(header, length); header = NLMSG_NEXT(header, length)) {
+            if (header->nlmsg_type == NLMSG_DONE)
+                return true;
+
+            if (header->nlmsg_type == NLMSG_ERROR)
+                return false;
+
+            if (header->nlmsg_type != RTM_NEWROUTE)
+                continue;
+
+            // Collect the attributes of one rule
+            std::uint32_t uid = 0, handled = 0, dropped = 0;
+            auto attribute = reinterpret_cast<struct rtattr*>(
+                static_cast<char*>(NLMSG_DATA(header)) +
+                NLMSG_ALIGN(sizeof(struct rtcanmsg)));
+            int attributesLength = static_cast<int>(
+                header->nlmsg_len - NLMSG_LENGTH(sizeof(struct rtcanmsg)));
+
+            for (; RTA_OK(attribute, attributesLength);
+                 attribute = RTA_NEXT(attribute, attributesLength)) {
+                switch (attribute->rta_type) {
+                case CGW_MOD_UID:
+                    std::memcpy(&uid, RTA_DATA(attribute), sizeof(uid));
+                    break;
+                case CGW_HANDLED:
+                    std::memcpy(&handled, RTA_DATA(attribute), sizeof(handled));
+                    break;
+                case CGW_DROPPED:
+                    std::memcpy(&dropped, RTA_DATA(attribute), sizeof(dropped));
+                    break;
+                default:
+                    break;
+                }
+            }
+
+            for (auto& route : routes) {
+                if (route.kernel && route.uid == uid) {
+                    route.handled = handled;
+                    route.dropped = dropped;
+                }
+            }
+        }
+    }
+}
+
+} // namespace gateway
@@ -0,0 +1,134 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015, 2016 Jacob McGladdery
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+-------------------------------------------------------------------------------
+
+CAN Gateway Routing
+
+Routes between CAN interfaces are read from a routing table and installed as
+CAN_GW netlink rules, so that routed frames never leave the kernel. Routes the
+kernel cannot express are forwarded in userspace with the same semantics.
+*/
+
+#ifndef _GATEWAY_H_
+#define _GATEWAY_H_
+
+#include <linux/can.h>
+
+#include <istream>
+#include <string>
+#include <vector>
+
+#include <cstdint>
+
+namespace gateway {
+
+// Modification functions, in the order the kernel applies them
+enum ModOp {
+    ModAnd,
+    ModOr,
+    ModXor,
+    ModSet,
+    ModAdd, // Byte-wise addition, userspace only
+    NumModOps
+};
+
+struct Modification {
+    struct can_frame frame;
+    std::uint8_t fields; // CGW_MOD_ID, CGW_MOD_DLC and CGW_MOD_DATA bits
+};
+
+struct Crc8 {
+    bool enabled;
+    std::int8_t fromIndex;
+    std::int8_t toIndex;
+    std::int8_t resultIndex;
+    std::uint8_t init;
+    std::uint8_t finalXor;
+    std::uint8_t table[256];
+};
+
+struct Route {
+    std::string source;
+    std::string destination;
+    int sourceIndex;
+    int destinationIndex;
+    struct can_filter filter;
+    Modification mods[NumModOps];
+    Crc8 crc8;
+
+    // A congested userspace route may replace a pending frame with a newer one
+    bool coalesce;
+
+    // Installed as a CAN_GW rule, otherwise forwarded in userspace
+    bool kernel;
+    std::uint32_t uid;
+
+    std::uint64_t handled;
+    std::uint64_t dropped;
+    std::uint64_t latencyTotal; // Userspace only, in nanoseconds
+    std::uint64_t latencyMax;
+};
+
+// Parse a routing table; errors are reported with their line number
+bool parseRoutes(std::istream& in, std::vector<Route>& routes);
+
+bool kernelExpressible(const Route& route);
+
+bool hasModifications(const Route& route);
+
+bool matches(const Route& route, int ifindex, canid_t id);
+
+// Apply the modifications and checksum in the same order as the kernel,
+// returns false when the frame has to be dropped
+bool applyModifications(const Route& route, struct can_frame& frame);
+
+// CAN_GW rules are managed through rtnetlink
+class Netlink {
+public:
+    Netlink();
+    ~Netlink();
+
+    Netlink(const Netlink&) = delete;
+    Netlink& operator=(const Netlink&) = delete;
+
+    bool open();
+
+    // Returns zero or the errno reported by the kernel
+    int install(const Route& route);
+    int remove(const Route& route);
+
+    // Copy the kernel handled and dropped counters into the routes
+    bool updateCounters(std::vector<Route>& routes);
+
+private:
+    int request(int type, const Route& route);
+    int acknowledge();
+
+    int sockfd_;
+    std::uint32_t sequence_;
+};
+
+} // namespace gateway
+
+#endif /* _GATEWAY_H_ */
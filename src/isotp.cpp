@@ -0,0 +1,528 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015, 2016 Jacob McGladdery
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "isotp.h"
+
+#include <endian.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+namespace isotp {
+
+namespace {
+
+using namespace std::chrono_literals;
+
+// Protocol Control Information (upper nibble of the first byte)
+constexpr std::uint8_t kSingleFrame      = 0x00;
+constexpr std::uint8_t kFirstFrame       = 0x10;
+constexpr std::uint8_t kConsecutiveFrame = 0x20;
+constexpr std::uint8_t kFlowControl      = 0x30;
+
+// Flow status values
+constexpr std::uint8_t kContinueToSend = 0x00;
+constexpr std::uint8_t kWait           = 0x01;
+constexpr std::uint8_t kOverflow       = 0x02;
+
+// Network layer timeouts (N_Bs and N_Cr)
+constexpr auto kFlowControlTimeout      = 1000ms;
+constexpr auto kConsecutiveFrameTimeout = 1000ms;
+
+// Delay before retrying a frame which the interface queue refused
+constexpr auto kRetryDelay = 1ms;
+
+// Round a payload length up to the next valid CAN FD data length
+std::size_t fdDataLength(std::size_t length) {
+    static const std::uint8_t lengths[] = { 8, 12, 16, 20, 24, 32, 48, 64 };
+
+    for (auto dl : lengths) {
+        if (length <= dl)
+            return dl;
+    }
+
+    return CANFD_MAX_DLEN;
+}
+
+void logId(const char* message, canid_t id) {
+    std::cerr << "isotp: " << message << " (0x"
+              << std::hex << std::uppercase
+              << std::setw(3) << std::setfill('0')
+              << (id & CAN_EFF_MASK) << ")" << std::endl;
+    std::cerr.copyfmt(std::ios(nullptr));
+}
+
+} // namespace
+
+Clock::duration decodeStMin(std::uint8_t stMin) {
+    if (stMin <= 0x7F)
+        return std::chrono::milliseconds(stMin);
+
+    if (stMin >= 0xF1 && stMin <= 0xF9)
+        return std::chrono::microseconds((stMin - 0xF0) * 100);
+
+    // Reserved values must be treated as the longest valid separation time
+    return 127ms;
+}
+
+bool validDataLength(std::size_t length) {
+    return length <= CANFD_MAX_DLEN && fdDataLength(length) == length;
+}
+
+BufferPool::BufferPool(std::size_t count, std::size_t size)
+    : size_(size)
+    , storage_(count * size)
+{
+    free_.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        free_.push_back(storage_.data() + (i * size));
+    }
+}
+
+std::uint8_t* BufferPool::acquire() {
+    if (free_.empty())
+        return nullptr;
+
+    auto buffer = free_.back();
+    free_.pop_back();
+    return buffer;
+}
+
+void BufferPool::release(std::uint8_t* buffer) {
+    if (buffer)
+        free_.push_back(buffer);
+}
+
+Engine::Engine(int sockfd, BufferPool& pool, Handler handler)
+    : sockfd_(sockfd)
+    , pool_(pool)
+    , handler_(std::move(handler))
+    , sessions_()
+{
+}
+
+int Engine::addSession(const Options& options) {
+    // Received frames are matched to a session by their ID alone
+    for (const auto& s : sessions_) {
+        if (s.used && s.options.rxId == options.rxId)
+            return -1;
+    }
+
+    for (std::size_t i = 0; i < sessions_.size(); ++i) {
+        Session& s = sessions_[i];
+        if (s.used)
+            continue;
+
+        s = Session();
+        s.options = options;
+        s.used = true;
+        s.rxState = RxState::Idle;
+        s.txState = TxState::Idle;
+        return static_cast<int>(i);
+    }
+
+    return -1;
+}
+
+bool Engine::busy(int session) const {
+    if (session < 0 || static_cast<std::size_t>(session) >= sessions_.size())
+        return false;
+
+    return sessions_[session].txState != TxState::Idle;
+}
+
+bool Engine::send(int session, const std::uint8_t* data, std::size_t length,
+                  Clock::time_point now) {
+    if (session < 0 || static_cast<std::size_t>(session) >= sessions_.size())
+        return false;
+
+    Session& s = sessions_[session];
+    const std::size_t dl = s.options.txDataLength;
+    struct canfd_frame frame;
+
+    if (!s.used || s.txState != TxState::Idle)
+        return false;
+
+    // Single Frame, with the escape sequence for CAN FD payloads
+    if (length <= 7) {
+        frame.data[0] = kSingleFrame | static_cast<std::uint8_t>(length);
+        std::memcpy(frame.data + 1, data, length);
+        return writeFrame(s, frame, 1 + length);
+    }
+
+    if (dl > CAN_MAX_DLEN && length <= dl - 2) {
+        frame.data[0] = kSingleFrame;
+        frame.data[1] = static_cast<std::uint8_t>(length);
+        std::memcpy(frame.data + 2, data, length);
+        return writeFrame(s, frame, 2 + length);
+    }
+
+    // Multi-frame transfer; keep a copy so the caller's buffer is free again
+    if (length > pool_.bufferSize() || length > UINT32_MAX)
+        return false;
+
+    s.txBuffer = pool_.acquire();
+    if (!s.txBuffer)
+        return false;
+
+    std::memcpy(s.txBuffer, data, length);
+
+    std::size_t header;
+    if (length <= kMaxShortLength) {
+        frame.data[0] = kFirstFrame | static_cast<std::uint8_t>(length >> 8);
+        frame.data[1] = static_cast<std::uint8_t>(length);
+        header = 2;
+    } else {
+        const std::uint32_t escaped = htobe32(static_cast<std::uint32_t>(length));
+        frame.data[0] = kFirstFrame;
+        frame.data[1] = 0;
+        std::memcpy(frame.data + 2, &escaped, sizeof(escaped));
+        header = 6;
+    }
+
+    const std::size_t n = dl - header;
+    std::memcpy(frame.data + header, s.txBuffer, n);
+    if (!writeFrame(s, frame, dl)) {
+        pool_.release(s.txBuffer);
+        s.txBuffer = nullptr;
+        return false;
+    }
+
+    s.txLength = static_cast<std::uint32_t>(length);
+    s.txOffset = static_cast<std::uint32_t>(n);
+    s.txSequence = 1;
+    s.txState = TxState::WaitFlowControl;
+    s.txDeadline = now + kFlowControlTimeout;
+    return true;
+}
+
+void Engine::receive(const struct canfd_frame& frame, Clock::time_point now) {
+    if (frame.len < 1)
+        return;
+
+    for (auto& s : sessions_) {
+        if (!s.used || s.options.rxId != frame.can_id)
+            continue;
+
+        switch (frame.data[0] & 0xF0) {
+        case kSingleFrame:
+            onSingleFrame(s, frame);
+            break;
+        case kFirstFrame:
+            onFirstFrame(s, frame, now);
+            break;
+        case kConsecutiveFrame:
+            onConsecutiveFrame(s, frame, now);
+            break;
+        case kFlowControl:
+            onFlowControl(s, frame, now);
+            break;
+        default:
+            // Unknown PCI types are ignored as required by ISO 15765-2
+            break;
+        }
+
+        return;
+    }
+}
+
+void Engine::service(Clock::time_point now) {
+    for (auto& s : sessions_) {
+        if (!s.used)
+            continue;
+
+        if (s.rxState == RxState::Receiving && now >= s.rxDeadline) {
+            logId("timeout waiting for consecutive frame", s.options.rxId);
+            abortRx(s);
+        }
+
+        switch (s.txState) {
+        case TxState::WaitFlowControl:
+            if (now >= s.txDeadline) {
+                logId("timeout waiting for flow control", s.options.rxId);
+                abortTx(s);
+            }
+            break;
+        case TxState::Sending:
+            sendConsecutiveFrames(s, now);
+            break;
+        case TxState::Idle:
+            break;
+        }
+    }
+}
+
+Clock::duration Engine::timeout(Clock::time_point now) const {
+    auto next = Clock::time_point::max();
+
+    for (const auto& s : sessions_) {
+        if (!s.used)
+            continue;
+
+        if (s.rxState == RxState::Receiving)
+            next = std::min(next, s.rxDeadline);
+
+        if (s.txState == TxState::WaitFlowControl)
+            next = std::min(next, s.txDeadline);
+        else if (s.txState == TxState::Sending)
+            next = std::min(next, s.txNext);
+    }
+
+    if (next == Clock::time_point::max())
+        return Clock::duration(-1);
+
+    return std::max(next - now, Clock::duration::zero());
+}
+
+void Engine::onSingleFrame(Session& s, const struct canfd_frame& frame) {
+    std::size_t length = frame.data[0] & 0x0F;
+    std::size_t offset = 1;
+
+    // A zero length in the first byte is the escape sequence for CAN FD
+    if (0 == length) {
+        if (frame.len <= CAN_MAX_DLEN)
+            return;
+
+        length = frame.data[1];
+        offset = 2;
+    }
+
+    if (0 == length || length > frame.len - offset)
+        return;
+
+    // A new message terminates a reception which is still in progress
+    if (s.rxState == RxState::Receiving) {
+        logId("reception interrupted by single frame", s.options.rxId);
+        abortRx(s);
+    }
+
+    handler_(static_cast<int>(&s - sessions_.data()),
+             frame.data + offset, length);
+}
+
+void Engine::onFirstFrame(Session& s, const struct canfd_frame& frame,
+                          Clock::time_point now) {
+    if (frame.len < CAN_MAX_DLEN)
+        return;
+
+    std::uint32_t length = ((frame.data[0] & 0x0F) << 8) | frame.data[1];
+    std::size_t header = 2;
+
+    if (0 == length) {
+        std::uint32_t escaped;
+        std::memcpy(&escaped, frame.data + 2, sizeof(escaped));
+        length = be32toh(escaped);
+        header = 6;
+
+        // The escape sequence is only valid for lengths the short form lacks
+        if (length <= kMaxShortLength) {
+            logId("malformed first frame", s.options.rxId);
+            return;
+        }
+    }
+
+    if (length < frame.len - header)
+        return;
+
+    if (s.rxState == RxState::Receiving) {
+        logId("reception interrupted by first frame", s.options.rxId);
+        abortRx(s);
+    }
+
+    // Refuse messages which do not fit in a pool buffer
+    if (length > pool_.bufferSize() || !(s.rxBuffer = pool_.acquire())) {
+        logId("no buffer for first frame", s.options.rxId);
+        sendFlowControl(s, kOverflow);
+        return;
+    }
+
+    const std::size_t n = frame.len - header;
+    std::memcpy(s.rxBuffer, frame.data + header, n);
+    s.rxLength = length;
+    s.rxOffset = static_cast<std::uint32_t>(n);
+    s.rxSequence = 1;
+    s.rxBlockCount = 0;
+    s.rxDeadline = now + kConsecutiveFrameTimeout;
+    s.rxState = RxState::Receiving;
+
+    sendFlowControl(s, kContinueToSend);
+}
+
+void Engine::onConsecutiveFrame(Session& s, const struct canfd_frame& frame,
+                                Clock::time_point now) {
+    if (s.rxState != RxState::Receiving)
+        return;
+
+    if ((frame.data[0] & 0x0F) != s.rxSequence) {
+        logId("wrong sequence number", s.options.rxId);
+        abortRx(s);
+        return;
+    }
+
+    const std::size_t n = std::min<std::size_t>(
+        frame.len - 1,
+        s.rxLength - s.rxOffset
+    );
+    std::memcpy(s.rxBuffer + s.rxOffset, frame.data + 1, n);
+    s.rxOffset += static_cast<std::uint32_t>(n);
+    s.rxSequence = (s.rxSequence + 1) & 0x0F;
+
+    if (s.rxOffset >= s.rxLength) {
+        handler_(static_cast<int>(&s - sessions_.data()),
+                 s.rxBuffer, s.rxLength);
+        abortRx(s);
+        return;
+    }
+
+    s.rxDeadline = now + kConsecutiveFrameTimeout;
+
+    // Ask for the next block once the current one has been received
+    if (s.options.blockSize != 0 && ++s.rxBlockCount >= s.options.blockSize) {
+        s.rxBlockCount = 0;
+        sendFlowControl(s, kContinueToSend);
+    }
+}
+
+void Engine::onFlowControl(Session& s, const struct canfd_frame& frame,
+                           Clock::time_point now) {
+    if (s.txState != TxState::WaitFlowControl || frame.len < 3)
+        return;
+
+    switch (frame.data[0] & 0x0F) {
+    case kContinueToSend:
+        s.txBlockSize = frame.data[1];
+        s.txBlockCount = 0;
+        s.txStMin = decodeStMin(frame.data[2]);
+        s.txNext = now;
+        s.txState = TxState::Sending;
+        sendConsecutiveFrames(s, now);
+        break;
+    case kWait:
+        s.txDeadline = now + kFlowControlTimeout;
+        break;
+    case kOverflow:
+        logId("receiver reported overflow", s.options.rxId);
+        abortTx(s);
+        break;
+    default:
+        logId("invalid flow status", s.options.rxId);
+        abortTx(s);
+        break;
+    }
+}
+
+void Engine::abortRx(Session& s) {
+    pool_.release(s.rxBuffer);
+    s.rxBuffer = nullptr;
+    s.rxState = RxState::Idle;
+}
+
+void Engine::abortTx(Session& s) {
+    pool_.release(s.txBuffer);
+    s.txBuffer = nullptr;
+    s.txState = TxState::Idle;
+}
+
+void Engine::sendConsecutiveFrames(Session& s, Clock::time_point now) {
+    const std::size_t payload = s.options.txDataLength - 1u;
+
+    // With an STmin of zero this bursts until the block or the queue is full
+    while (s.txState == TxState::Sending && now >= s.txNext) {
+        struct canfd_frame frame;
+        const std::size_t n = std::min<std::size_t>(
+            payload,
+            s.txLength - s.txOffset
+        );
+
+        frame.data[0] = kConsecutiveFrame | s.txSequence;
+        std::memcpy(frame.data + 1, s.txBuffer + s.txOffset, n);
+        if (!writeFrame(s, frame, 1 + n)) {
+            s.txNext = now + kRetryDelay;
+            return;
+        }
+
+        s.txOffset += static_cast<std::uint32_t>(n);
+        s.txSequence = (s.txSequence + 1) & 0x0F;
+
+        if (s.txOffset >= s.txLength) {
+            abortTx(s);
+            return;
+        }
+
+        if (s.txBlockSize != 0 && ++s.txBlockCount >= s.txBlockSize) {
+            s.txBlockCount = 0;
+            s.txDeadline = now + kFlowControlTimeout;
+            s.txState = TxState::WaitFlowControl;
+            return;
+        }
+
+        s.txNext = now + s.txStMin;
+    }
+}
+
+bool Engine::sendFlowControl(Session& s, std::uint8_t status) {
+    struct canfd_frame frame;
+
+    frame.data[0] = kFlowControl | status;
+    frame.data[1] = s.options.blockSize;
+    frame.data[2] = s.options.stMin;
+    return writeFrame(s, frame, 3);
+}
+
+bool Engine::writeFrame(const Session& s, struct canfd_frame& frame,
+                        std::size_t length) {
+    std::size_t dl = CAN_MAX_DLEN;
+    std::size_t mtu = CAN_MTU;
+
+    if (s.options.txDataLength > CAN_MAX_DLEN) {
+        dl = fdDataLength(length);
+        mtu = CANFD_MTU;
+    }
+
+    // Always pad; CAN FD frames can only carry a few distinct lengths
+    std::memset(frame.data + length, s.options.padding, dl - length);
+    frame.can_id = s.options.txId;
+    frame.len = static_cast<std::uint8_t>(dl);
+    frame.flags = 0;
+    frame.__res0 = 0;
+    frame.__res1 = 0;
+
+    auto numBytes = ::write(sockfd_, &frame, mtu);
+    if (numBytes == static_cast<ssize_t>(mtu))
+        return true;
+
+    // A full interface queue is expected under load and simply retried
+    if (-1 == numBytes && ENOBUFS != errno && EAGAIN != errno)
+        std::perror("isotp: write");
+
+    return false;
+}
+
+} // namespace isotp
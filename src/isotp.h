@@ -0,0 +1,177 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015, 2016 Jacob McGladdery
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+-------------------------------------------------------------------------------
+
+Userspace ISO 15765-2 (ISO-TP) Engine
+
+This is the fallback used when the kernel does not provide CAN_ISOTP sockets.
+The engine runs on top of a CAN_RAW socket. It segments outgoing messages,
+reassembles incoming ones and takes care of flow control. Reassembly and
+transmit buffers come from a fixed-size pool which is allocated up front, so
+no heap allocation happens per message.
+*/
+
+#ifndef _ISOTP_H_
+#define _ISOTP_H_
+
+#include <linux/can.h>
+
+#include <array>
+#include <chrono>
+#include <functional>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace isotp {
+
+using Clock = std::chrono::steady_clock;
+
+// Largest message length which fits in the 12 bit First Frame length field
+constexpr std::uint32_t kMaxShortLength = 4095;
+
+// Largest message length a pool buffer may be sized for, to keep the pool
+// allocated at startup within reason
+constexpr std::uint32_t kMaxLength = 1u << 20;
+
+// Maximum number of concurrent sessions (ID pairs) per engine
+constexpr std::size_t kMaxSessions = 16;
+
+struct Options {
+    canid_t txId;
+    canid_t rxId;
+    std::uint8_t blockSize;    // BS sent in our flow control frames, 0 = off
+    std::uint8_t stMin;        // STmin sent in our flow control frames
+    std::uint8_t txDataLength; // 8 for classic CAN, a CAN FD length up to 64
+    std::uint8_t padding;      // Content of padding bytes
+};
+
+// Decode an STmin byte into a duration as described in ISO 15765-2
+Clock::duration decodeStMin(std::uint8_t stMin);
+
+// Whether a CAN FD frame can carry exactly this many bytes
+bool validDataLength(std::size_t length);
+
+// Fixed-size pool of equally sized message buffers
+class BufferPool {
+public:
+    BufferPool(std::size_t count, std::size_t size);
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    std::uint8_t* acquire();
+    void release(std::uint8_t* buffer);
+
+    std::size_t bufferSize() const { return size_; }
+    std::size_t available() const { return free_.size(); }
+
+private:
+    std::size_t size_;
+    std::vector<std::uint8_t> storage_;
+    std::vector<std::uint8_t*> free_;
+};
+
+class Engine {
+public:
+    using Handler = std::function<
+        void(int session, const std::uint8_t* data, std::size_t length)>;
+
+    Engine(int sockfd, BufferPool& pool, Handler handler);
+
+    Engine(const Engine&) = delete;
+    Engine& operator=(const Engine&) = delete;
+
+    // Register an ID pair, returns the session number or -1 when full or
+    // when another session already receives on the same ID
+    int addSession(const Options& options);
+
+    // Queue a message for transmission. The data is copied into a pool
+    // buffer when it does not fit in a Single Frame.
+    bool send(int session, const std::uint8_t* data, std::size_t length,
+              Clock::time_point now);
+    bool busy(int session) const;
+
+    // Feed a frame read from the raw socket
+    void receive(const struct canfd_frame& frame, Clock::time_point now);
+
+    // Send pending Consecutive Frames and expire timed out transfers
+    void service(Clock::time_point now);
+
+    // Time until service() has work to do, or a negative duration if idle
+    Clock::duration timeout(Clock::time_point now) const;
+
+private:
+    enum class RxState { Idle, Receiving };
+    enum class TxState { Idle, WaitFlowControl, Sending };
+
+    struct Session {
+        Options options;
+        bool used;
+
+        RxState rxState;
+        std::uint8_t* rxBuffer;
+        std::uint32_t rxLength;
+        std::uint32_t rxOffset;
+        std::uint8_t rxSequence;
+        std::uint8_t rxBlockCount;
+        Clock::time_point rxDeadline;
+
+        TxState txState;
+        std::uint8_t* txBuffer;
+        std::uint32_t txLength;
+        std::uint32_t txOffset;
+        std::uint8_t txSequence;
+        std::uint8_t txBlockSize;
+        std::uint8_t txBlockCount;
+        Clock::duration txStMin;
+        Clock::time_point txNext;
+        Clock::time_point txDeadline;
+    };
+
+    void onSingleFrame(Session& s, const struct canfd_frame& frame);
+    void onFirstFrame(Session& s, const struct canfd_frame& frame,
+                      Clock::time_point now);
+    void onConsecutiveFrame(Session& s, const struct canfd_frame& frame,
+                            Clock::time_point now);
+    void onFlowControl(Session& s, const struct canfd_frame& frame,
+                       Clock::time_point now);
+
+    void abortRx(Session& s);
+    void abortTx(Session& s);
+    void sendConsecutiveFrames(Session& s, Clock::time_point now);
+    bool sendFlowControl(Session& s, std::uint8_t status);
+    bool writeFrame(const Session& s, struct canfd_frame& frame,
+                    std::size_t length);
+
+    int sockfd_;
+    BufferPool& pool_;
+    Handler handler_;
+    std::array<Session, kMaxSessions> sessions_;
+};
+
+} // namespace isotp
+
+#endif /* _ISOTP_H_ */
@@ -0,0 +1,168 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015, 2016 Jacob McGladdery
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "profiler.h"
+
+#include <signal.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include <cinttypes>
+#include <csignal>
+#include <cstdio>
+
+namespace profiler {
+
+thread_local ThreadData* current = nullptr;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const char* const kStageNames[NumStages] = {
+    "read",
+    "decode",
+    "log",
+    "modify",
+    "write"
+};
+
+// Every thread which recorded a lap, newest first
+std::atomic<ThreadData*> threads(nullptr);
+
+volatile std::sig_atomic_t dumpRequested = 0;
+
+// Reference points to convert ticks into nanoseconds
+std::uint64_t startTicks;
+Clock::time_point startTime;
+
+void onSignal(int) {
+    dumpRequested = 1;
+}
+
+double nanosecondsPerTick() {
+    const auto ticks = profiler::ticks() - startTicks;
+    const auto elapsed = std::chrono::duration<double, std::nano>(
+        Clock::now() - startTime).count();
+
+    return (ticks > 0) ? (elapsed / ticks) : 1.0;
+}
+
+// Upper bound of the bucket holding the given fraction of the samples
+std::uint64_t percentile(const std::uint64_t* histogram,
+                         std::uint64_t count, double fraction) {
+    const auto target = static_cast<std::uint64_t>(count * fraction);
+    std::uint64_t seen = 0;
+
+    for (int i = 0; i < kBuckets; ++i) {
+        seen += histogram[i];
+        if (seen > target)
+            return (i < 63) ? ((std::uint64_t(2) << i) - 1) : UINT64_MAX;
+    }
+
+    return 0;
+}
+
+} // namespace
+
+ThreadData* registerThread() {
+    auto data = new ThreadData();
+
+    data->next = threads.load(std::memory_order_relaxed);
+    while (!threads.compare_exchange_weak(data->next, data,
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed)) {
+    }
+
+    current = data;
+    return data;
+}
+
+void install() {
+    struct sigaction sa;
+
+    startTicks = ticks();
+    startTime = Clock::now();
+
+    // No SA_RESTART, so a blocking read returns and the loop can dump
+    sa.sa_handler = onSignal;
+    ::sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    ::sigaction(SIGUSR1, &sa, nullptr);
+}
+
+void check() {
+    if (dumpRequested) {
+        dumpRequested = 0;
+        dump();
+    }
+}
+
+void dump() {
+    const double scale = nanosecondsPerTick();
+
+    // Percentiles are only known to the power of two bucket holding them,
+    // which is never reported above the maximum
+    std::fprintf(stderr, "%-8s %12s %12s %12s %12s %12s\n",
+                 "Stage", "Count", "Mean ns", "p50 <= ns", "p99 <= ns", "Max ns");
+
+    for (int stage = 0; stage < NumStages; ++stage) {
+        std::uint64_t histogram[kBuckets] = {};
+        std::uint64_t count = 0;
+        std::uint64_t total = 0;
+        std::uint64_t max = 0;
+
+        // Merge the histograms of all threads
+        for (auto data = threads.load(std::memory_order_acquire);
+             data; data = data->next) {
+            for (int i = 0; i < kBuckets; ++i) {
+                const auto n = data->histogram[stage][i].load(
+                    std::memory_order_relaxed);
+                histogram[i] += n;
+                count += n;
+            }
+
+            total += data->total[stage].load(std::memory_order_relaxed);
+            if (data->max[stage].load(std::memory_order_relaxed) > max)
+                max = data->max[stage].load(std::memory_order_relaxed);
+        }
+
+        if (0 == count)
+            continue;
+
+        std::fprintf(stderr, "%-8s %12" PRIu64 " %12.0f %12.0f %12.0f %12.0f\n",
+                     kStageNames[stage], count,
+                     scale * total / count,
+                     scale * std::min(percentile(histogram, count, 0.50), max),
+                     scale * std::min(percentile(histogram, count, 0.99), max),
+                     scale * max);
+    }
+
+    std::fprintf(stderr, "p50 and p99 are upper bounds of log2 buckets and may"
+                 " be up to 2x high;\nread includes any blocking wait for"
+                 " frames\n");
+}
+
+} // namespace profiler
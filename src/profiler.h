@@ -0,0 +1,134 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015, 2016 Jacob McGladdery
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+-------------------------------------------------------------------------------
+
+Stage Profiler
+
+Lightweight instrumentation for the main loops. PROFILE_START() marks the
+beginning of an iteration and every PROFILE_LAP(stage) charges the cycles
+since the previous mark to that stage. Each thread fills its own log2
+histograms, so recording is a time stamp counter read and a few stores.
+The histograms of all threads are merged when they are dumped, which happens
+on SIGUSR1 (see PROFILE_CHECK) or at exit (see PROFILE_DUMP).
+
+Compile with -DNPROFILE to remove every instrumentation point.
+*/
+
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+
+#include <atomic>
+
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+namespace profiler {
+
+enum Stage {
+    Read,
+    Decode,
+    Log,
+    Modify,
+    Write,
+    NumStages
+};
+
+// One bucket per power of two cycles
+constexpr int kBuckets = 64;
+
+struct ThreadData {
+    std::uint64_t last;
+    std::atomic<std::uint64_t> total[NumStages];
+    std::atomic<std::uint64_t> max[NumStages];
+    std::atomic<std::uint64_t> histogram[NumStages][kBuckets];
+    ThreadData* next;
+};
+
+extern thread_local ThreadData* current;
+
+ThreadData* registerThread();
+
+// SIGUSR1 requests a dump; also calibrates the time stamp counter
+void install();
+
+// Dump the merged histograms to stderr if a dump was requested
+void check();
+void dump();
+
+inline std::uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return static_cast<std::uint64_t>(ts.tv_sec) * 1000000000u +
+        static_cast<std::uint64_t>(ts.tv_nsec);
+#endif
+}
+
+inline void start() {
+    ThreadData* data = current ? current : registerThread();
+    data->last = ticks();
+}
+
+// Each thread is the only writer of its own counters
+inline void lap(Stage stage) {
+    ThreadData* data = current ? current : registerThread();
+    const std::uint64_t now = ticks();
+    const std::uint64_t elapsed = now - data->last;
+    const int bucket = 63 - __builtin_clzll(elapsed | 1);
+    auto& count = data->histogram[stage][bucket];
+
+    data->last = now;
+    count.store(count.load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+    data->total[stage].store(
+        data->total[stage].load(std::memory_order_relaxed) + elapsed,
+        std::memory_order_relaxed);
+    if (elapsed > data->max[stage].load(std::memory_order_relaxed))
+        data->max[stage].store(elapsed, std::memory_order_relaxed);
+}
+
+} // namespace profiler
+
+#ifndef NPROFILE
+#define PROFILE_INSTALL()   profiler::install()
+#define PROFILE_START()     profiler::start()
+#define PROFILE_LAP(stage)  profiler::lap(profiler::stage)
+#define PROFILE_CHECK()     profiler::check()
+#define PROFILE_DUMP()      profiler::dump()
+#else
+#define PROFILE_INSTALL()   ((void)0)
+#define PROFILE_START()     ((void)0)
+#define PROFILE_LAP(stage)  ((void)0)
+#define PROFILE_CHECK()     ((void)0)
+#define PROFILE_DUMP()      ((void)0)
+#endif
+
+#endif /* _PROFILER_H_ */
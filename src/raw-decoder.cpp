@@ -0,0 +1,140 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015, 2016 Jacob McGladdery
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "raw-decoder.h"
+#include "profiler.h"
+
+#include <iomanip>
+#include <iostream>
+
+#include <cstring>
+
+namespace decoder {
+
+namespace {
+
+const char* const kLabels[signals::NumSignals] = {
+    "RPM"
+};
+
+} // namespace
+
+inline namespace DECODER_BUILD {
+
+void processFrame(const struct canfd_frame& frame, std::uint64_t timestamp,
+                  signals::Region& signalCache, stats::Table& canStats,
+                  aggregate::Aggregator& aggregator) {
+    switch (frame.can_id) {
+    case 0x0A0:
+    {
+        EngineFrame engine;
+        engine.rpm = decodeRpm(frame);
+        signals::publish(signalCache.slots[signals::EngineRpm],
+                         engine.rpm, timestamp);
+        PROFILE_LAP(Decode);
+        aggregator.add(signals::EngineRpm, engine.rpm, timestamp);
+    }
+        break;
+    case 0x110:
+    {
+        // TODO: Work!
+        // VehicleFrame vehicle;
+        std::cout << "Got 0x110\n"; // XXX
+    }
+        break;
+    case 0x320:
+    {
+        // TODO: Work!
+        // BodyControllerFrame bodyController;
+        std::cout << "Got 0x320\n"; // XXX
+    }
+        break;
+    default:
+        // Should never get here if the receive filters were set up correctly
+        canStats.unexpected(frame.can_id);
+        std::cerr << "Unexpected CAN ID: 0x"
+                  << std::hex << std::uppercase
+                  << std::setw(3) << std::setfill('0')
+                  << frame.can_id << std::endl;
+        std::cerr.copyfmt(std::ios(nullptr));
+        break;
+    }
+
+    PROFILE_LAP(Log);
+}
+
+void processXlFrame(const struct canxl_frame& frame, std::uint64_t timestamp,
+                    signals::Region& signalCache, stats::Table& canStats,
+                    aggregate::Aggregator& aggregator) {
+    const canid_t priority = frame.prio & CANXL_PRIO_MASK;
+#ifdef CANXL_VCID_MASK
+    const unsigned int vcid = (frame.prio & CANXL_VCID_MASK) >> CANXL_VCID_OFFSET;
+#else
+    const unsigned int vcid = 0;
+#endif
+
+    // Dispatch on the priority ID and virtual network first, then the SDU type
+    if (kXlEnginePriority == priority && 0 == vcid &&
+        kXlEngineSamples == frame.sdt && frame.len >= 2) {
+        const std::size_t samples = frame.len / 2;
+        std::uint16_t rpm = 0;
+
+        // Every sample is aggregated, but only the latest one is published
+        for (std::size_t i = 0; i < samples; ++i) {
+            std::memcpy(&rpm, frame.data + 2 * i, sizeof(rpm));
+            rpm = be16toh(rpm);
+            aggregator.add(signals::EngineRpm, rpm, timestamp);
+        }
+        signals::publish(signalCache.slots[signals::EngineRpm], rpm, timestamp);
+        PROFILE_LAP(Decode);
+    } else {
+        canStats.unexpectedXl(priority);
+        std::cerr << "Unexpected CAN XL frame: 0x"
+                  << std::hex << std::uppercase
+                  << std::setw(3) << std::setfill('0') << priority
+                  << " SDT 0x" << std::setw(2) << unsigned(frame.sdt)
+                  << " VCID 0x" << std::setw(2) << vcid << std::endl;
+        std::cerr.copyfmt(std::ios(nullptr));
+    }
+
+    PROFILE_LAP(Log);
+}
+
+void printSignal(const aggregate::Output& output) {
+    std::cout << kLabels[output.signal] << ": ";
+
+    if (aggregate::Window == output.mode) {
+        std::cout << "min " << output.min
+                  << " max " << output.max
+                  << " mean " << output.mean
+                  << " last " << output.last
+                  << " count " << output.count << '\n';
+    } else {
+        std::cout << output.last << '\n';
+    }
+}
+
+} // inline namespace DECODER_BUILD
+
+} // namespace decoder
@@ -0,0 +1,106 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015, 2016 Jacob McGladdery
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+-------------------------------------------------------------------------------
+
+Raw Interface Demo Message Decoder
+
+Decodes the hypothetical CAN messages recognized by the raw interface demo.
+The decoder lives in its own translation unit so that the benchmarks can
+drive exactly the code the service runs.
+*/
+
+#ifndef _RAW_DECODER_H_
+#define _RAW_DECODER_H_
+
+#include "aggregator.h"
+#include "can-stats.h"
+#include "signal-cache.h"
+
+#include <linux/can.h>
+
+#include <endian.h>
+
+#include <cstdint>
+
+// Objects built with -DNPROFILE define the decoder in a namespace of their own,
+// so the benchmark can link both builds side by side
+#ifdef NPROFILE
+#define DECODER_BUILD unprofiled
+#else
+#define DECODER_BUILD profiled
+#endif
+
+namespace decoder {
+
+struct EngineFrame {
+    std::uint16_t rpm;
+    // TODO: Some more hypothetical data
+};
+
+struct VehicleFrame {
+    // TODO: Some hypothetical vehicle status measurements
+};
+
+struct BodyControllerFrame {
+    // TODO: Some hypothetical vehicle settings flags
+};
+
+// Hypothetical CAN XL backbone message; its SDU type selects the layout
+constexpr canid_t kXlEnginePriority = 0x0A8;
+constexpr std::uint8_t kXlEngineSamples = 0x80; // Big endian RPM samples
+
+inline std::uint16_t decodeRpm(const struct canfd_frame& frame) {
+    return be16toh(*(std::uint16_t *)(frame.data + 0));
+}
+
+inline namespace DECODER_BUILD {
+
+void processFrame(const struct canfd_frame& frame, std::uint64_t timestamp,
+                  signals::Region& signalCache, stats::Table& canStats,
+                  aggregate::Aggregator& aggregator);
+
+// Decodes the payload in place, without copying it out of the receive buffer
+void processXlFrame(const struct canxl_frame& frame, std::uint64_t timestamp,
+                    signals::Region& signalCache, stats::Table& canStats,
+                    aggregate::Aggregator& aggregator);
+
+// Prints what the aggregator emits; the caller flushes std::cout
+void printSignal(const aggregate::Output& output);
+
+} // inline namespace DECODER_BUILD
+
+#ifndef NPROFILE
+// The dispatch of an object built with -DNPROFILE, see socketcan-bench
+namespace unprofiled {
+
+void processFrame(const struct canfd_frame& frame, std::uint64_t timestamp,
+                  signals::Region& signalCache, stats::Table& canStats,
+                  aggregate::Aggregator& aggregator);
+
+} // namespace unprofiled
+#endif
+
+} // namespace decoder
+
+#endif /* _RAW_DECODER_H_ */
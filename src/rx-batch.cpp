@@ -0,0 +1,75 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015, 2016 Jacob McGladdery
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "rx-batch.h"
+
+#include <linux/can/raw.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+namespace rx {
+
+bool enableXlFrames(int sockfd) {
+    int enable = 1;
+
+    if (::setsockopt(sockfd, SOL_CAN_RAW, CAN_RAW_XL_FRAMES,
+                     &enable, sizeof(enable)) == -1) {
+        if (ENOPROTOOPT != errno)
+            std::perror("setsockopt CAN XL");
+        return false;
+    }
+
+#ifdef CAN_RAW_XL_VCID_OPTS
+    // Pass the virtual CAN network ID of every frame through in the priority
+    struct can_raw_vcid_options vcid;
+    std::memset(&vcid, 0, sizeof(vcid));
+    vcid.flags = CAN_RAW_XL_VCID_RX_FILTER;
+    vcid.rx_vcid = 0;
+    vcid.rx_vcid_mask = 0;
+    if (::setsockopt(sockfd, SOL_CAN_RAW, CAN_RAW_XL_VCID_OPTS,
+                     &vcid, sizeof(vcid)) == -1)
+        std::perror("setsockopt CAN XL VCID");
+#endif
+
+    return true;
+}
+
+Batch::Batch() {
+    std::memset(messages_, 0, sizeof(messages_));
+
+    for (std::size_t i = 0; i < kBatchFrames; ++i) {
+        iovecs_[i].iov_base = &buffers_[i];
+        iovecs_[i].iov_len = sizeof(buffers_[i]);
+        messages_[i].msg_hdr.msg_iov = &iovecs_[i];
+        messages_[i].msg_hdr.msg_iovlen = 1;
+    }
+}
+
+int Batch::receive(int sockfd) {
+    return ::recvmmsg(sockfd, messages_, kBatchFrames, MSG_WAITFORONE, nullptr);
+}
+
+} // namespace rx
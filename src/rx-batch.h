@@ -0,0 +1,99 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015, 2016 Jacob McGladdery
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+-------------------------------------------------------------------------------
+
+Batched Frame Reception
+
+Receives CAN, CAN FD and CAN XL frames from a raw socket in batches. The batch
+owns a fixed pool of buffers which are each large enough for a CAN XL frame, so
+a frame of any type can land in any buffer and nothing is allocated or copied
+after the kernel fills them. One recvmmsg() call blocks for the first frame and
+then takes whatever else is already queued. Decoders get references into the
+pool, which stay valid until the next call to receive().
+*/
+
+#ifndef _RX_BATCH_H_
+#define _RX_BATCH_H_
+
+#include <linux/can.h>
+
+#include <sys/socket.h>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace rx {
+
+constexpr std::size_t kBatchFrames = 16;
+
+union Buffer {
+    struct can_frame classic;
+    struct canfd_frame fd;
+    struct canxl_frame xl;
+};
+
+enum FrameType {
+    Classic,
+    Fd,
+    Xl,
+    Invalid
+};
+
+// CAN XL frames have a variable size, so they are told apart by the XLF bit,
+// which overlaps the length of the other frame types
+inline FrameType frameType(const Buffer& buffer, std::size_t size) {
+    if (size >= CANXL_HDR_SIZE + CANXL_MIN_DLEN && (buffer.xl.flags & CANXL_XLF))
+        return (size == CANXL_HDR_SIZE + buffer.xl.len) ? Xl : Invalid;
+    if (CAN_MTU == size)
+        return Classic;
+    if (CANFD_MTU == size)
+        return Fd;
+    return Invalid;
+}
+
+// Allow CAN XL frames on a raw socket; false if the kernel predates them
+bool enableXlFrames(int sockfd);
+
+class Batch {
+public:
+    Batch();
+
+    Batch(const Batch&) = delete;
+    Batch& operator=(const Batch&) = delete;
+
+    // Number of frames received, or -1 with errno set
+    int receive(int sockfd);
+
+    std::size_t size(std::size_t index) const { return messages_[index].msg_len; }
+    const Buffer& operator[](std::size_t index) const { return buffers_[index]; }
+
+private:
+    Buffer buffers_[kBatchFrames];
+    struct iovec iovecs_[kBatchFrames];
+    struct mmsghdr messages_[kBatchFrames];
+};
+
+} // namespace rx
+
+#endif /* _RX_BATCH_H_ */
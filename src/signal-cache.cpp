@@ -0,0 +1,208 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015, 2016 Jacob McGladdery
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "signal-cache.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <iostream>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+namespace signals {
+
+namespace {
+
+const char* const kNames[NumSignals] = {
+    "rpm"
+};
+
+// Process ID of the writer which left an existing region behind, 0 when it
+// is still running and -1 when the region cannot tell
+pid_t deadOwner(const char* name) {
+    struct stat st;
+    pid_t owner = -1;
+
+    int fd = ::shm_open(name, O_RDONLY, 0);
+    if (-1 == fd)
+        return -1;
+
+    if (::fstat(fd, &st) == 0 &&
+        st.st_size >= static_cast<off_t>(sizeof(Region))) {
+        void* memory = ::mmap(nullptr, sizeof(Region), PROT_READ, MAP_SHARED,
+                              fd, 0);
+        if (memory != MAP_FAILED) {
+            auto region = static_cast<const Region*>(memory);
+            if (region->magic.load(std::memory_order_acquire) == kMagic &&
+                region->version == kVersion && region->owner > 0)
+                owner = region->owner;
+            ::munmap(memory, sizeof(Region));
+        }
+    }
+    ::close(fd);
+
+    if (owner > 0 && (::kill(owner, 0) == 0 || EPERM == errno))
+        return 0;
+    return owner;
+}
+
+} // namespace
+
+const char* signalName(SignalId signal) {
+    return kNames[signal];
+}
+
+Region* create(const char* name) {
+    // Never take over a region which another writer may still be using
+    int fd = ::shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (-1 == fd && EEXIST == errno) {
+        const pid_t owner = deadOwner(name);
+
+        if (0 == owner) {
+            std::cerr << name << ": signal cache is in use by another writer"
+                      << std::endl;
+            return nullptr;
+        }
+
+        if (-1 == owner) {
+            std::cerr << name << ": signal cache exists and its writer is"
+                         " unknown (remove /dev/shm" << name << " if it was"
+                         " left behind)" << std::endl;
+            return nullptr;
+        }
+
+        // The writer crashed or was killed without removing its region
+        std::cerr << name << ": replacing the signal cache left behind by"
+                     " process " << owner << std::endl;
+        ::shm_unlink(name);
+        fd = ::shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    }
+
+    if (-1 == fd) {
+        std::perror("shm_open");
+        return nullptr;
+    }
+
+    if (::ftruncate(fd, sizeof(Region)) == -1) {
+        std::perror("ftruncate");
+        ::close(fd);
+        ::shm_unlink(name);
+        return nullptr;
+    }
+
+    void* memory = ::mmap(nullptr, sizeof(Region), PROT_READ | PROT_WRITE,
+                          MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (MAP_FAILED == memory) {
+        std::perror("mmap");
+        ::shm_unlink(name);
+        return nullptr;
+    }
+
+    // The region is new and zero filled, so readers see no magic until now
+    auto region = static_cast<Region*>(memory);
+
+    region->version = kVersion;
+    region->slotCount = NumSignals;
+    region->slotSize = sizeof(Slot);
+    region->owner = ::getpid();
+    for (std::uint32_t i = 0; i < NumSignals; ++i) {
+        Slot& slot = region->slots[i];
+        slot.sequence.store(0, std::memory_order_relaxed);
+        slot.updates.store(0, std::memory_order_relaxed);
+        slot.timestamp.store(0, std::memory_order_relaxed);
+        slot.value.store(0, std::memory_order_relaxed);
+        std::strncpy(slot.name, kNames[i], kNameSize - 1);
+        slot.name[kNameSize - 1] = '\0';
+    }
+
+    region->magic.store(kMagic, std::memory_order_release);
+    return region;
+}
+
+void destroy(Region* region, const char* name) {
+    if (!region)
+        return;
+
+    ::munmap(region, sizeof(Region));
+    ::shm_unlink(name);
+}
+
+const Region* attach(const char* name) {
+    struct stat st;
+
+    int fd = ::shm_open(name, O_RDONLY, 0);
+    if (-1 == fd) {
+        std::perror("shm_open");
+        return nullptr;
+    }
+
+    if (::fstat(fd, &st) == -1 ||
+        st.st_size < static_cast<off_t>(sizeof(Region))) {
+        std::cerr << name << ": region is too small" << std::endl;
+        ::close(fd);
+        return nullptr;
+    }
+
+    void* memory = ::mmap(nullptr, sizeof(Region), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (MAP_FAILED == memory) {
+        std::perror("mmap");
+        return nullptr;
+    }
+
+    auto region = static_cast<const Region*>(memory);
+    if (region->magic.load(std::memory_order_acquire) != kMagic ||
+        region->version != kVersion ||
+        region->slotCount != NumSignals ||
+        region->slotSize != sizeof(Slot)) {
+        std::cerr << name << ": incompatible region layout" << std::endl;
+        detach(region);
+        return nullptr;
+    }
+
+    return region;
+}
+
+void detach(const Region* region) {
+    if (region)
+        ::munmap(const_cast<Region*>(region), sizeof(Region));
+}
+
+std::uint64_t now() {
+    struct timespec ts;
+
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<std::uint64_t>(ts.tv_sec) * 1000000000u +
+        static_cast<std::uint64_t>(ts.tv_nsec);
+}
+
+} // namespace signals
@@ -0,0 +1,133 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015, 2016 Jacob McGladdery
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+-------------------------------------------------------------------------------
+
+Shared Memory Signal Cache
+
+The raw interface service publishes the latest value of every decoded signal
+into a POSIX shared memory region. Each signal has its own cache line sized
+slot guarded by a seqlock. There is a single writer, so other processes can
+take consistent snapshots without system calls and without ever blocking it.
+*/
+
+#ifndef _SIGNAL_CACHE_H_
+#define _SIGNAL_CACHE_H_
+
+#include <atomic>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace signals {
+
+// Every signal owns a fixed slot; append new signals before NumSignals
+enum SignalId : std::uint32_t {
+    EngineRpm,
+    NumSignals
+};
+
+constexpr const char* kDefaultName = "/socketcan-signals";
+constexpr std::uint32_t kMagic = 0x53494743; // "SIGC"
+constexpr std::uint32_t kVersion = 2;
+constexpr std::size_t kNameSize = 24;
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2,
+              "Slots must be lock-free to be shared between processes");
+
+struct alignas(64) Slot {
+    std::atomic<std::uint32_t> sequence; // Odd while an update is in progress
+    std::atomic<std::uint64_t> updates;
+    std::atomic<std::uint64_t> timestamp; // CLOCK_MONOTONIC nanoseconds
+    std::atomic<std::int64_t> value;
+    char name[kNameSize];
+};
+
+struct Region {
+    std::atomic<std::uint32_t> magic; // Set last, once the region is ready
+    std::uint32_t version;
+    std::uint32_t slotCount;
+    std::uint32_t slotSize;
+    std::int32_t owner; // Process ID of the writer
+    Slot slots[NumSignals];
+};
+
+struct Snapshot {
+    std::uint64_t updates;
+    std::uint64_t timestamp;
+    std::int64_t value;
+};
+
+// Writer side; only one process may publish into a region
+inline void publish(Slot& slot, std::int64_t value, std::uint64_t timestamp) {
+    const auto sequence = slot.sequence.load(std::memory_order_relaxed);
+
+    slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.value.store(value, std::memory_order_relaxed);
+    slot.timestamp.store(timestamp, std::memory_order_relaxed);
+    slot.updates.store(slot.updates.load(std::memory_order_relaxed) + 1,
+                       std::memory_order_relaxed);
+
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+// Single snapshot attempt; fails only if it raced with the writer
+inline bool tryRead(const Slot& slot, Snapshot& snapshot) {
+    const auto before = slot.sequence.load(std::memory_order_acquire);
+    if (before & 1)
+        return false;
+
+    snapshot.value = slot.value.load(std::memory_order_relaxed);
+    snapshot.timestamp = slot.timestamp.load(std::memory_order_relaxed);
+    snapshot.updates = slot.updates.load(std::memory_order_relaxed);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return before == slot.sequence.load(std::memory_order_relaxed);
+}
+
+inline void read(const Slot& slot, Snapshot& snapshot) {
+    while (!tryRead(slot, snapshot)) {
+    }
+}
+
+// Create and initialize a new region, returns nullptr on error or if the
+// name is taken by a running writer. A region whose writer has died is
+// replaced.
+Region* create(const char* name);
+void destroy(Region* region, const char* name);
+
+// Map an existing region read-only, returns nullptr on error
+const Region* attach(const char* name);
+void detach(const Region* region);
+
+// Name of a signal's slot, such as "rpm"
+const char* signalName(SignalId signal);
+
+// CLOCK_MONOTONIC timestamp as used in the slots
+std::uint64_t now();
+
+} // namespace signals
+
+#endif /* _SIGNAL_CACHE_H_ */
@@ -0,0 +1,253 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015, 2016 Jacob McGladdery
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+-------------------------------------------------------------------------------
+
+Trace Archive Tool
+
+This program packs candump log files into the block archive format and runs
+queries against archives. Extracted records are printed as candump log lines,
+so the output can be fed to canplayer or compared with the original log.
+*/
+
+#include "can-archive.h"
+
+#include <unistd.h>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#define PROGNAME  "socketcan-archive"
+#define VERSION  "1.0.0"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+void usage() {
+    std::cout << "Usage: " PROGNAME " [-h] [-V] [-b records] -c archive [log]"
+              << std::endl
+              << "       " PROGNAME " [-i ids] [-s start] [-e end] [-q]"
+                 " -x archive" << std::endl
+              << "Options:" << std::endl
+              << "  -h  Display this information" << std::endl
+              << "  -V  Display version information" << std::endl
+              << "  -c  Create an archive from a candump log (default stdin)"
+              << std::endl
+              << "  -b  Records per block (default " << archive::kBlockRecords
+              << ")" << std::endl
+              << "  -x  Print the matching records of an archive" << std::endl
+              << "  -i  Comma separated hexadecimal CAN IDs to match"
+              << std::endl
+              << "  -s  Earliest timestamp to match, in seconds" << std::endl
+              << "  -e  Latest timestamp to match, in seconds" << std::endl
+              << "  -q  Only count the matching records" << std::endl
+              << std::endl;
+}
+
+void version() {
+    std::cout << PROGNAME " version " VERSION << std::endl
+              << "Compiled on " __DATE__ ", " __TIME__ << std::endl
+              << std::endl;
+}
+
+// IDs with more than three digits are extended, as in candump logs
+bool parseIds(const std::string& text, std::vector<canid_t>& ids) {
+    std::istringstream in(text);
+    std::string token;
+
+    while (std::getline(in, token, ',')) {
+        char* end;
+        const auto id = static_cast<canid_t>(std::strtoul(token.c_str(), &end, 16));
+
+        if (token.empty() || *end != '\0')
+            return false;
+        ids.push_back((token.size() > 3) ? (id | CAN_EFF_FLAG) : id);
+    }
+
+    return !ids.empty();
+}
+
+std::uint64_t parseSeconds(const char* text) {
+    return static_cast<std::uint64_t>(std::strtod(text, nullptr) * 1e9);
+}
+
+int create(const char* path, const char* logPath, std::size_t blockRecords) {
+    archive::Writer writer(blockRecords);
+    std::ifstream file;
+    std::istream* in = &std::cin;
+    std::string line, interface;
+    archive::Record record;
+    std::uint64_t logBytes = 0;
+    std::uint64_t frames = 0;
+    std::uint64_t skipped = 0;
+
+    if (logPath) {
+        file.open(logPath);
+        if (!file) {
+            std::perror(logPath);
+            return EXIT_FAILURE;
+        }
+        in = &file;
+    }
+
+    if (!writer.open(path))
+        return EXIT_FAILURE;
+
+    while (std::getline(*in, line)) {
+        logBytes += line.size() + 1;
+
+        if (!archive::parseLogLine(line, interface, record)) {
+            ++skipped;
+            continue;
+        }
+
+        record.interface = interface.c_str();
+        if (!writer.add(record))
+            return EXIT_FAILURE;
+        ++frames;
+    }
+
+    if (!writer.close())
+        return EXIT_FAILURE;
+
+    std::cerr << frames << " frames (" << skipped << " lines skipped), "
+              << logBytes << " bytes of log to " << writer.bytesWritten()
+              << " bytes";
+    if (writer.bytesWritten() > 0)
+        std::cerr << " (" << static_cast<double>(logBytes) / writer.bytesWritten()
+                  << "x smaller)";
+    std::cerr << std::endl;
+
+    return EXIT_SUCCESS;
+}
+
+int extract(const char* path, const archive::Query& query, bool quiet) {
+    archive::Reader reader;
+    std::string out;
+    std::uint64_t matches = 0;
+
+    if (!reader.open(path))
+        return EXIT_FAILURE;
+
+    const auto start = Clock::now();
+    const bool ok = reader.query(query, [&](const archive::Record& record) {
+        ++matches;
+        if (quiet)
+            return;
+
+        archive::formatLogLine(record, out);
+        if (out.size() >= 65536) {
+            std::fwrite(out.data(), 1, out.size(), stdout);
+            out.clear();
+        }
+    });
+    std::fwrite(out.data(), 1, out.size(), stdout);
+    std::fflush(stdout);
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::cerr << matches << " records from " << reader.blocksDecoded()
+              << " blocks (" << reader.blocksSkipped() << " skipped) in "
+              << seconds * 1e3 << " ms";
+    if (seconds > 0)
+        std::cerr << ", " << matches * sizeof(struct canfd_frame) / seconds / 1e6
+                  << " MB/s of frames";
+    std::cerr << std::endl;
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    // Options
+    const char* createPath = nullptr;
+    const char* extractPath = nullptr;
+    std::size_t blockRecords = archive::kBlockRecords;
+    archive::Query query;
+    bool quiet = false;
+
+    // Parse command line arguments
+    {
+        int opt;
+
+        // Parse option flags
+        while ((opt = ::getopt(argc, argv, "Vhc:b:x:i:s:e:q")) != -1) {
+            switch (opt) {
+            case 'V':
+                version();
+                return EXIT_SUCCESS;
+            case 'h':
+                usage();
+                return EXIT_SUCCESS;
+            case 'c':
+                createPath = optarg;
+                break;
+            case 'b':
+                blockRecords = std::strtoul(optarg, nullptr, 0);
+                break;
+            case 'x':
+                extractPath = optarg;
+                break;
+            case 'i':
+                if (!parseIds(optarg, query.ids)) {
+                    std::cerr << "Invalid CAN ID list: " << optarg << std::endl;
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 's':
+                query.from = parseSeconds(optarg);
+                break;
+            case 'e':
+                query.to = parseSeconds(optarg);
+                break;
+            case 'q':
+                quiet = true;
+                break;
+            default:
+                usage();
+                return EXIT_FAILURE;
+            }
+        }
+
+        // Exactly one mode; only creation takes an input file
+        if (!createPath == !extractPath ||
+            argc - optind > (createPath ? 1 : 0)) {
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (createPath)
+        return create(createPath, (optind < argc) ? argv[optind] : nullptr,
+                      blockRecords);
+
+    return extract(extractPath, query, quiet);
+}
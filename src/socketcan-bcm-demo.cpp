@@ -32,6 +32,8 @@ byte in the received message, and then write that message back out on to the
 bus with the message ID defined by the macro MSGID.
 */
 
+#include "profiler.h"
+#include "tx-queue.h"
 #include "util.h"
 
 #include <errno.h>
@@ -41,6 +43,7 @@ bus with the message ID defined by the macro MSGID.
 #include <string.h>
 
 #include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
 #include <net/if.h>
 #include <sys/types.h>
@@ -56,8 +59,6 @@ bus with the message ID defined by the macro MSGID.
 #define MSGID   (0x0BC)
 #define NFRAMES (1)
 
-#define DELAY (10000)
-
 static sig_atomic_t sigval;
 
 static void onsig(int val)
@@ -88,10 +89,12 @@ int main(int argc, char **argv)
     struct sockaddr_can addr;
     struct ifreq ifr;
     
-    struct can_msg
+    /* The frames follow the flexible array member of the message head */
+    union can_msg
     {
         struct bcm_msg_head msg_head;
-        struct can_frame frame[NFRAMES];
+        unsigned char raw[sizeof(struct bcm_msg_head) +
+                          NFRAMES * sizeof(struct can_frame)];
     } msg;
 
     /* Check if at least one argument was specified */
@@ -140,6 +143,9 @@ int main(int argc, char **argv)
         return errno;
     }
 
+    /* SIGUSR1 dumps the stage profile */
+    PROFILE_INSTALL();
+
     /* Open the CAN interface */
     s = socket(PF_CAN, SOCK_DGRAM, CAN_BCM);
     if (s < 0)
@@ -190,75 +196,117 @@ int main(int argc, char **argv)
         return errno;
     }
 
-    /* Main loop */
-    while (0 == sigval)
-    {
+    /* Echoed frames are written in priority order as the device allows */
+    tx::Queue txQueue(tx::kDefaultCapacity, [s](const tx::Frame& pending) {
+        union can_msg out;
         ssize_t nbytes;
-
-        /* Read from the CAN interface */
-        nbytes = read(s, &msg, sizeof(msg));
+        int err;
+
+        /* Set a TX message for sending this frame once */
+        out.msg_head.opcode  = TX_SEND;
+        out.msg_head.can_id  = 0;
+        out.msg_head.flags   = 0;
+        out.msg_head.nframes = 1;
+        memcpy(out.msg_head.frames, &pending.frame, sizeof(struct can_frame));
+
+        /* Write the message out to the bus */
+        nbytes = write(s, &out, sizeof(out));
+        PROFILE_LAP(Write);
         if (nbytes < 0)
         {
-            if (errno != EAGAIN)
+            err = errno;
+            if (err != EAGAIN && err != ENOBUFS)
             {
-                perror(PROGNAME ": read");
+                perror(PROGNAME ": write: TX_SEND");
             }
-
-            usleep(DELAY);
+            return err;
         }
-        else if (nbytes < (ssize_t)sizeof(msg))
+        else if (nbytes < (ssize_t)sizeof(out))
         {
-            fputs(PROGNAME ": read: incomplete BCM message\n", stderr);
-            usleep(DELAY);
+            fputs(PROGNAME ": write: incomplete BCM message\n", stderr);
+            return EIO;
         }
-        else
+
+        /* Print the transmitted CAN frame */
+        printf("TX:  ");
+        print_can_frame(out.msg_head.frames);
+        printf("\n");
+        PROFILE_LAP(Log);
+        return 0;
+    });
+
+    /* Main loop */
+    while (0 == sigval)
+    {
+        struct pollfd fd;
+        ssize_t nbytes;
+
+        PROFILE_CHECK();
+
+        /* Sleep until a message arrives or the queue can make progress */
+        fd.fd      = s;
+        fd.events  = POLLIN | txQueue.events();
+        fd.revents = 0;
+        if (poll(&fd, 1, tx::pollTimeout(txQueue.timeout(tx::Clock::now()))) < 0)
         {
-            struct can_frame * const frame = msg.frame;
-            unsigned char * const data = frame->data;
-            const unsigned int dlc = frame->can_dlc;
-            unsigned int i;
-
-            /* Print the received CAN frame */
-            printf("RX:  ");
-            print_can_frame(frame);
-            printf("\n");
-
-            /* Modify the CAN frame to use our message ID */
-            frame->can_id = MSGID;
-            
-            /* Increment the value of each byte in the CAN frame */
-            for (i = 0; i < dlc; ++i)
+            if (errno != EINTR)
             {
-                data[i] += 1;
+                perror(PROGNAME ": poll");
             }
+            continue;
+        }
 
-            /* Set a TX message for sending this frame once */
-            msg.msg_head.opcode  = TX_SEND;
-            msg.msg_head.can_id  = 0;
-            msg.msg_head.flags   = 0;
-            msg.msg_head.nframes = 1;
+        /* The wait is not charged to any stage */
+        PROFILE_START();
 
-            /* Write the message out to the bus */
-            nbytes = write(s, &msg, sizeof(msg));
+        if (fd.revents & POLLIN)
+        {
+            /* Read from the CAN interface */
+            nbytes = read(s, &msg, sizeof(msg));
+            PROFILE_LAP(Read);
             if (nbytes < 0)
             {
-                perror(PROGNAME ": write: TX_SEND");
+                if (errno != EAGAIN)
+                {
+                    perror(PROGNAME ": read");
+                }
             }
             else if (nbytes < (ssize_t)sizeof(msg))
             {
-                fputs(PROGNAME ": write: incomplete BCM message\n", stderr);
+                fputs(PROGNAME ": read: incomplete BCM message\n", stderr);
             }
             else
             {
-                /* Print the transmitted CAN frame */
-                printf("TX:  ");
+                struct can_frame * const frame = msg.msg_head.frames;
+                tx::Frame pending;
+
+                /* Print the received CAN frame */
+                printf("RX:  ");
                 print_can_frame(frame);
                 printf("\n");
+                PROFILE_LAP(Log);
+
+                /* Modify the CAN frame to use our message ID */
+                frame->can_id = MSGID;
+
+                /* Increment the value of each byte in the CAN frame */
+                increment_can_frame(frame);
+
+                /* Queue it, replacing an echo which has not been sent yet */
+                memset(&pending, 0, sizeof(pending));
+                memcpy(&pending.frame, frame, sizeof(*frame));
+                pending.coalesce = true;
+                txQueue.push(pending);
+                PROFILE_LAP(Modify);
             }
         }
+
+        /* Write out whatever the device accepts, lapping per frame */
+        txQueue.flush(tx::Clock::now());
     }
 
     puts("\nGoodbye!");
+    PROFILE_DUMP();
 
     /* Close the CAN interface */
     if (close(s) < 0)
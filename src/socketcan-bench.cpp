@@ -0,0 +1,476 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015, 2016 Jacob McGladdery
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+-------------------------------------------------------------------------------
+
+Microbenchmarks
+
+This program times the hot kernels of the demos on a mix of frames: the
+message dispatch of the raw interface demo, with and without the stage
+profiler, the big endian RPM extraction, the byte increment transform of the
+broadcast manager demo and the frame formatting used for logging. The frame
+mix is either synthetic or read from a candump log file. Results are given in
+nanoseconds per frame together with the instructions per cycle when
+perf_event_open is available, and may be compared against a baseline file to
+flag regressions.
+*/
+
+#include "can-archive.h"
+#include "raw-decoder.h"
+#include "util.h"
+
+#include <linux/perf_event.h>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#define PROGNAME  "socketcan-bench"
+#define VERSION  "1.0.0"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Every kernel runs for at least this long
+constexpr auto kMinDuration = std::chrono::milliseconds(200);
+
+struct Result {
+    std::string name;
+    double nsPerFrame;
+    double ipc; // Negative when no hardware counters are available
+};
+
+// Cycle and instruction counters for the calling thread
+class PerfCounters {
+public:
+    PerfCounters()
+        : cycles_(open(PERF_COUNT_HW_CPU_CYCLES, -1))
+        , instructions_(-1)
+    {
+        if (cycles_ != -1)
+            instructions_ = open(PERF_COUNT_HW_INSTRUCTIONS, cycles_);
+    }
+
+    ~PerfCounters() {
+        if (instructions_ != -1)
+            ::close(instructions_);
+        if (cycles_ != -1)
+            ::close(cycles_);
+    }
+
+    bool available() const { return instructions_ != -1; }
+
+    void start() {
+        if (!available())
+            return;
+        ::ioctl(cycles_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ::ioctl(cycles_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+
+    double stop() {
+        struct {
+            std::uint64_t count;
+            std::uint64_t values[2];
+        } group;
+
+        if (!available())
+            return -1.0;
+
+        ::ioctl(cycles_, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        if (::read(cycles_, &group, sizeof(group)) != sizeof(group) ||
+            0 == group.values[0])
+            return -1.0;
+
+        return static_cast<double>(group.values[1]) / group.values[0];
+    }
+
+private:
+    static int open(std::uint64_t config, int group) {
+        struct perf_event_attr attr;
+
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = config;
+        attr.disabled = (-1 == group);
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+
+        return static_cast<int>(::syscall(__NR_perf_event_open, &attr, 0, -1,
+                                          group, 0));
+    }
+
+    int cycles_;
+    int instructions_;
+};
+
+void usage() {
+    std::cout << "Usage: " PROGNAME " [-h] [-V] [-r log] [-n frames]"
+                 " [-b baseline] [-u] [-t percent]" << std::endl
+              << "Options:" << std::endl
+              << "  -h  Display this information" << std::endl
+              << "  -V  Display version information" << std::endl
+              << "  -r  Use the frames of a candump log file" << std::endl
+              << "  -n  Number of synthetic frames (default 65536)" << std::endl
+              << "  -b  Compare against a baseline file, or create it"
+              << std::endl
+              << "  -u  Overwrite the baseline file with these results"
+              << std::endl
+              << "  -t  Slowdown in percent flagged as a regression"
+                 " (default 10)" << std::endl
+              << std::endl;
+}
+
+void version() {
+    std::cout << PROGNAME " version " VERSION << std::endl
+              << "Compiled on " __DATE__ ", " __TIME__ << std::endl
+              << std::endl;
+}
+
+// The mix the raw demo filters for, plus a few IDs hitting the default branch
+std::vector<struct canfd_frame> syntheticFrames(std::size_t count) {
+    std::mt19937 random(12345);
+    std::vector<struct canfd_frame> frames(count);
+
+    for (auto& frame : frames) {
+        const auto pick = random() % 100;
+
+        std::memset(&frame, 0, sizeof(frame));
+        frame.can_id = (pick < 60) ? 0x0A0
+                     : (pick < 85) ? 0x110
+                     : (pick < 99) ? 0x320
+                     : 0x7FF;
+        frame.len = static_cast<std::uint8_t>(1 + random() % CAN_MAX_DLEN);
+        for (std::size_t i = 0; i < frame.len; ++i) {
+            frame.data[i] = static_cast<std::uint8_t>(random());
+        }
+    }
+
+    return frames;
+}
+
+bool recordedFrames(const char* path, std::vector<struct canfd_frame>& frames) {
+    std::ifstream in(path);
+    std::string line, interface;
+    archive::Record record;
+
+    if (!in) {
+        std::perror(path);
+        return false;
+    }
+
+    while (std::getline(in, line)) {
+        if (archive::parseLogLine(line, interface, record))
+            frames.push_back(record.frame);
+    }
+
+    return true;
+}
+
+template <typename Kernel>
+Result run(const char* name, std::vector<struct canfd_frame>& frames,
+           PerfCounters& counters, Kernel kernel) {
+    std::uint64_t processed = 0;
+
+    // Warm up caches and branch predictors
+    for (auto& frame : frames) {
+        kernel(frame);
+    }
+
+    counters.start();
+    const auto start = Clock::now();
+    auto elapsed = Clock::duration::zero();
+    do {
+        for (auto& frame : frames) {
+            kernel(frame);
+        }
+        processed += frames.size();
+        elapsed = Clock::now() - start;
+    } while (elapsed < kMinDuration);
+    const double ipc = counters.stop();
+
+    const double ns = std::chrono::duration<double, std::nano>(elapsed).count();
+    return { name, ns / processed, ipc };
+}
+
+// Results are only comparable when they were taken on the same frames
+struct Baseline {
+    std::string source; // "synthetic" or the path of the candump log
+    std::size_t frames;
+    std::map<std::string, double> nsPerFrame;
+};
+
+// The first line is "frames COUNT SOURCE", followed by "KERNEL NS" lines
+bool readBaseline(const char* path, Baseline& baseline) {
+    std::ifstream in(path);
+    std::string keyword, name;
+    double ns;
+
+    if (!(in >> keyword >> baseline.frames) || keyword != "frames" ||
+        !std::getline(in >> std::ws, baseline.source))
+        return false;
+
+    while (in >> name >> ns) {
+        baseline.nsPerFrame[name] = ns;
+    }
+
+    return true;
+}
+
+bool writeBaseline(const char* path, const std::string& source,
+                   std::size_t frames, const std::vector<Result>& results) {
+    std::ofstream out(path);
+
+    out << "frames " << frames << ' ' << source << '\n';
+    for (const auto& result : results) {
+        out << result.name << ' ' << result.nsPerFrame << '\n';
+    }
+
+    if (!out) {
+        std::perror(path);
+        return false;
+    }
+
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    // Options
+    const char* recordedPath = nullptr;
+    const char* baselinePath = nullptr;
+    std::size_t count = 65536;
+    bool update = false;
+    double threshold = 10.0;
+
+    std::vector<struct canfd_frame> frames;
+    std::vector<Result> results;
+    bool regression = false;
+
+    // Parse command line arguments
+    {
+        int opt;
+
+        // Parse option flags
+        while ((opt = ::getopt(argc, argv, "Vhr:n:b:ut:")) != -1) {
+            switch (opt) {
+            case 'V':
+                version();
+                return EXIT_SUCCESS;
+            case 'h':
+                usage();
+                return EXIT_SUCCESS;
+            case 'r':
+                recordedPath = optarg;
+                break;
+            case 'n':
+                count = std::strtoul(optarg, nullptr, 0);
+                break;
+            case 'b':
+                baselinePath = optarg;
+                break;
+            case 'u':
+                update = true;
+                break;
+            case 't':
+                threshold = std::strtod(optarg, nullptr);
+                break;
+            default:
+                usage();
+                return EXIT_FAILURE;
+            }
+        }
+
+        if (optind != argc) {
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (recordedPath) {
+        if (!recordedFrames(recordedPath, frames))
+            return EXIT_FAILURE;
+    } else {
+        frames = syntheticFrames(count);
+    }
+
+    if (frames.empty()) {
+        std::cerr << "No frames to run on!" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // The kernels log to stdout and stderr, so discard both while they run
+    int savedStdout = ::dup(STDOUT_FILENO);
+    int savedStderr = ::dup(STDERR_FILENO);
+    int devnull = ::open("/dev/null", O_WRONLY);
+    if (-1 == savedStdout || -1 == savedStderr || -1 == devnull) {
+        std::perror("open");
+        return EXIT_FAILURE;
+    }
+    ::dup2(devnull, STDOUT_FILENO);
+    ::dup2(devnull, STDERR_FILENO);
+    ::close(devnull);
+
+    // Run the kernels
+    bool measuredIpc;
+    {
+        static signals::Region signalCache;
+        static stats::Table canStats;
+        static aggregate::Aggregator aggregator(decoder::printSignal);
+        PerfCounters counters;
+        std::uint64_t timestamp = 0;
+        volatile std::uint32_t sink = 0;
+
+        results.push_back(run("dispatch", frames, counters,
+            [&](const struct canfd_frame& frame) {
+                decoder::processFrame(frame, ++timestamp, signalCache, canStats,
+                                      aggregator);
+            }));
+
+        // The same dispatch built with -DNPROFILE, to measure the laps
+        results.push_back(run("noprofile", frames, counters,
+            [&](const struct canfd_frame& frame) {
+                decoder::unprofiled::processFrame(frame, ++timestamp,
+                                                  signalCache, canStats,
+                                                  aggregator);
+            }));
+
+        results.push_back(run("be16toh", frames, counters,
+            [&](const struct canfd_frame& frame) {
+                sink = sink + decoder::decodeRpm(frame);
+            }));
+
+        // Incremented in place, so the other kernels keep the original frames
+        std::vector<struct canfd_frame> scratch(frames);
+        results.push_back(run("increment", scratch, counters,
+            [&](struct canfd_frame& frame) {
+                increment_can_frame(reinterpret_cast<struct can_frame*>(&frame));
+            }));
+
+        results.push_back(run("print", frames, counters,
+            [&](const struct canfd_frame& frame) {
+                print_can_frame(reinterpret_cast<const struct can_frame*>(&frame));
+                std::putchar('\n');
+            }));
+
+        measuredIpc = counters.available();
+    }
+
+    std::cout.flush();
+    std::cerr.flush();
+    ::dup2(savedStdout, STDOUT_FILENO);
+    ::dup2(savedStderr, STDERR_FILENO);
+    ::close(savedStdout);
+    ::close(savedStderr);
+
+    if (!measuredIpc)
+        std::cerr << "perf_event_open unavailable, IPC not measured" << std::endl;
+
+    // Report and compare against the baseline
+    {
+        const std::string source = recordedPath ? recordedPath : "synthetic";
+        Baseline baseline = Baseline();
+        const bool compare = baselinePath && !update &&
+            std::ifstream(baselinePath).good();
+
+        if (compare) {
+            if (!readBaseline(baselinePath, baseline)) {
+                std::cerr << baselinePath << ": not a baseline file,"
+                             " rerun with -u to replace it" << std::endl;
+                return EXIT_FAILURE;
+            }
+
+            if (baseline.source != source || baseline.frames != frames.size()) {
+                std::cerr << "Baseline was taken on " << baseline.frames << " "
+                          << baseline.source << " frames, not "
+                          << frames.size() << " " << source
+                          << "; rerun with -u to replace it" << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+
+        std::cout << frames.size() << " "
+                  << (recordedPath ? "recorded" : "synthetic") << " frames"
+                  << std::endl
+                  << std::left << std::setw(12) << "Kernel"
+                  << std::right << std::setw(12) << "ns/frame"
+                  << std::setw(8) << "IPC"
+                  << std::setw(14) << "Baseline" << std::endl;
+
+        for (const auto& result : results) {
+            std::cout << std::left << std::setw(12) << result.name
+                      << std::right << std::fixed << std::setprecision(2)
+                      << std::setw(12) << result.nsPerFrame;
+
+            if (result.ipc >= 0)
+                std::cout << std::setw(8) << result.ipc;
+            else
+                std::cout << std::setw(8) << "-";
+
+            const auto it = baseline.nsPerFrame.find(result.name);
+            if (it != baseline.nsPerFrame.end()) {
+                const double change = 100.0 * (result.nsPerFrame / it->second - 1.0);
+                std::cout << std::setw(13) << std::showpos << change << "%"
+                          << std::noshowpos;
+                if (change > threshold) {
+                    std::cout << "  REGRESSION";
+                    regression = true;
+                }
+            }
+
+            std::cout << std::endl;
+        }
+
+        const double overhead =
+            100.0 * (results[0].nsPerFrame / results[1].nsPerFrame - 1.0);
+        std::cout << "Profiler overhead in dispatch: " << std::showpos
+                  << overhead << "%" << std::noshowpos << std::endl;
+
+        // Record the baseline on the first run or when asked to
+        if (baselinePath && !compare) {
+            if (!writeBaseline(baselinePath, source, frames.size(), results))
+                return EXIT_FAILURE;
+            std::cout << "Baseline written to " << baselinePath << std::endl;
+        }
+    }
+
+    return regression ? EXIT_FAILURE : EXIT_SUCCESS;
+}
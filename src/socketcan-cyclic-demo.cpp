@@ -88,10 +88,12 @@ int main(int argc, char **argv)
     struct sockaddr_can addr;
     struct ifreq ifr;
     
-    struct can_msg
+    /* The frames follow the flexible array member of the message head */
+    union can_msg
     {
         struct bcm_msg_head msg_head;
-        struct can_frame frame[NFRAMES];
+        unsigned char raw[sizeof(struct bcm_msg_head) +
+                          NFRAMES * sizeof(struct can_frame)];
     } msg;
 
     /* Check if at least one argument was specified */
@@ -182,7 +184,7 @@ int main(int argc, char **argv)
     /* Create the example messages */
     for (i = 0; i < NFRAMES; ++i)
     {
-        struct can_frame * const frame = msg.frame + i;
+        struct can_frame * const frame = msg.msg_head.frames + i;
         frame->can_id = MSGID + i;
         frame->can_dlc = MSGLEN;
         memset(frame->data, i, MSGLEN);
@@ -0,0 +1,557 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015, 2016 Jacob McGladdery
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+-------------------------------------------------------------------------------
+
+Gateway Routing Demo
+
+This program routes CAN frames between interfaces. The routes are read from a
+routing table file and installed as kernel CAN_GW rules so that routed frames
+do not cross into userspace. Routes which the kernel cannot express, such as
+byte-wise addition, are forwarded in userspace instead. The hit counters of
+every route are reported periodically so that both paths can be compared.
+
+The routing table holds one route per line:
+
+    SOURCE ID[/MASK] DESTINATION [MODIFICATION]... [coalesce]
+
+Where a modification is one of:
+
+    and:FIELD=VALUE   or:FIELD=VALUE   xor:FIELD=VALUE   set:FIELD=VALUE
+    add:FIELD=VALUE   crc8:FROM,TO,RESULT[,POLY[,INIT[,XOR]]]
+
+FIELD is one of id, dlc or data. Data values are given as 16 hex digits. With
+coalesce, a userspace route which is waiting for the destination may replace a
+pending frame with a newer one of the same ID; the replaced frame is counted
+as dropped.
+*/
+
+#include "gateway.h"
+#include "rx-batch.h"
+#include "tx-queue.h"
+
+#include <linux/can.h>
+#include <linux/can/raw.h>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#define PROGNAME  "socketcan-gw-demo"
+#define VERSION  "1.0.0"
+
+namespace {
+
+// Each route gets a rule UID made from our PID and its index in the table
+constexpr std::size_t kMaxRoutes = 256;
+
+// Frames forwarded per wakeup, so a busy route cannot starve the main loop
+constexpr std::size_t kForwardBatch = 64;
+
+std::sig_atomic_t signalValue;
+
+// CAN XL frames bypass the transmit queue, so they are totalled separately
+struct XlTotals {
+    std::uint64_t sent;
+    std::uint64_t dropped;
+} xlTotals;
+
+void onSignal(int value) {
+    signalValue = static_cast<decltype(signalValue)>(value);
+}
+
+void usage() {
+    std::cout << "Usage: " PROGNAME " [-h] [-V] [-u] [-i seconds] routes"
+              << std::endl
+              << "Options:" << std::endl
+              << "  -h  Display this information" << std::endl
+              << "  -V  Display version information" << std::endl
+              << "  -u  Forward every route in userspace" << std::endl
+              << "  -i  Seconds between counter reports (default 1)"
+              << std::endl
+              << std::endl;
+}
+
+void version() {
+    std::cout << PROGNAME " version " VERSION << std::endl
+              << "Compiled on " __DATE__ ", " __TIME__ << std::endl
+              << std::endl;
+}
+
+std::uint64_t toNanoseconds(const struct timespec& ts) {
+    return static_cast<std::uint64_t>(ts.tv_sec) * 1000000000u +
+        static_cast<std::uint64_t>(ts.tv_nsec);
+}
+
+void report(const std::vector<gateway::Route>& routes, const tx::Queue& txQueue,
+            std::vector<std::uint64_t>& previous, double seconds) {
+    std::cout << "Route  Source    Destination  Path       "
+                 "    Handled    Dropped   Frames/s  Latency us (max)"
+              << std::endl;
+
+    for (std::size_t i = 0; i < routes.size(); ++i) {
+        const auto& route = routes[i];
+        const auto delta = route.handled - previous[i];
+
+        std::cout << std::left
+                  << std::setw(7) << i
+                  << std::setw(10) << route.source
+                  << std::setw(13) << route.destination
+                  << std::setw(11) << (route.kernel ? "kernel" : "userspace")
+                  << std::right
+                  << std::setw(11) << route.handled
+                  << std::setw(11) << route.dropped
+                  << std::setw(11) << std::fixed << std::setprecision(1)
+                  << ((seconds > 0) ? (delta / seconds) : 0.0);
+
+        // Only frames forwarded by us can be timed
+        if (!route.kernel && route.handled > 0) {
+            std::cout << "  " << std::setprecision(1)
+                      << (route.latencyTotal / 1000.0 / route.handled)
+                      << " (" << (route.latencyMax / 1000.0) << ")";
+        }
+
+        std::cout << std::endl;
+        previous[i] = route.handled;
+    }
+
+    // Frames which never made it out of the transmit queue
+    std::cout << "TX queue: " << txQueue.size() << " pending, "
+              << txQueue.replaced() << " replaced, "
+              << txQueue.dropped() << " dropped" << std::endl
+              << "CAN XL: " << xlTotals.sent << " sent, "
+              << xlTotals.dropped << " dropped" << std::endl;
+
+    std::cout.copyfmt(std::ios(nullptr));
+}
+
+int openForwarder(const std::vector<gateway::Route>& routes) {
+    std::vector<struct can_filter> filter;
+    struct sockaddr_can addr;
+    int enable = 1;
+    int disable = 0;
+    int sockfd;
+
+    for (const auto& route : routes) {
+        if (!route.kernel)
+            filter.push_back(route.filter);
+    }
+
+    sockfd = ::socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    if (-1 == sockfd) {
+        std::perror("socket");
+        return -1;
+    }
+
+    // Like the kernel gateway, do not echo routed frames to local sockets
+    if (::setsockopt(sockfd, SOL_CAN_RAW, CAN_RAW_FILTER, filter.data(),
+                     filter.size() * sizeof(filter[0])) == -1 ||
+        ::setsockopt(sockfd, SOL_CAN_RAW, CAN_RAW_LOOPBACK,
+                     &disable, sizeof(disable)) == -1 ||
+        ::setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPNS,
+                     &enable, sizeof(enable)) == -1) {
+        std::perror("setsockopt");
+        ::close(sockfd);
+        return -1;
+    }
+
+    // CAN XL frames are forwarded too, where the kernel supports them
+    if (!rx::enableXlFrames(sockfd))
+        std::cerr << "CAN XL frames are not supported" << std::endl;
+
+    // Back pressure should reach the transmit queue as POLLOUT
+    if (!tx::limitSendBuffer(sockfd)) {
+        ::close(sockfd);
+        return -1;
+    }
+
+    // Bind to all interfaces; the source is known from the sender address
+    std::memset(&addr, 0, sizeof(addr));
+    addr.can_family = AF_CAN;
+    addr.can_ifindex = 0;
+    if (::bind(sockfd, reinterpret_cast<struct sockaddr*>(&addr),
+               sizeof(addr)) == -1) {
+        std::perror("bind");
+        ::close(sockfd);
+        return -1;
+    }
+
+    return sockfd;
+}
+
+// Writes a queued frame and accounts for it on its route
+int transmit(int sockfd, std::vector<gateway::Route>& routes,
+             const tx::Frame& pending) {
+    auto& route = routes[pending.tag];
+    struct sockaddr_can to;
+
+    std::memset(&to, 0, sizeof(to));
+    to.can_family = AF_CAN;
+    to.can_ifindex = pending.ifindex;
+
+    if (::sendto(sockfd, &pending.frame, CAN_MTU, MSG_DONTWAIT,
+                 reinterpret_cast<struct sockaddr*>(&to),
+                 sizeof(to)) != CAN_MTU) {
+        const int err = errno;
+        if (EAGAIN != err && EWOULDBLOCK != err && ENOBUFS != err)
+            ++route.dropped;
+        return err;
+    }
+
+    // Receive timestamp to completed write
+    struct timespec sent;
+    ::clock_gettime(CLOCK_REALTIME, &sent);
+    const auto latency = toNanoseconds(sent) - pending.timestamp;
+
+    ++route.handled;
+    route.latencyTotal += latency;
+    if (latency > route.latencyMax)
+        route.latencyMax = latency;
+
+    return 0;
+}
+
+// CAN XL frames bypass the transmit queue and are written as received; the
+// modifications only apply to classic frames
+void forwardXl(int sockfd, std::vector<gateway::Route>& routes, int ifindex,
+               const struct canxl_frame& frame, std::size_t size,
+               std::uint64_t received) {
+    for (auto& route : routes) {
+        if (route.kernel ||
+            !gateway::matches(route, ifindex, frame.prio & CANXL_PRIO_MASK))
+            continue;
+
+        if (gateway::hasModifications(route)) {
+            ++route.dropped;
+            ++xlTotals.dropped;
+            continue;
+        }
+
+        struct sockaddr_can to;
+        std::memset(&to, 0, sizeof(to));
+        to.can_family = AF_CAN;
+        to.can_ifindex = route.destinationIndex;
+
+        // Without a queue to wait in, a congested destination loses the frame
+        if (::sendto(sockfd, &frame, size, MSG_DONTWAIT,
+                     reinterpret_cast<struct sockaddr*>(&to),
+                     sizeof(to)) != static_cast<ssize_t>(size)) {
+            ++route.dropped;
+            ++xlTotals.dropped;
+            continue;
+        }
+
+        ++xlTotals.sent;
+
+        struct timespec sent;
+        ::clock_gettime(CLOCK_REALTIME, &sent);
+        const auto latency = toNanoseconds(sent) - received;
+
+        ++route.handled;
+        route.latencyTotal += latency;
+        if (latency > route.latencyMax)
+            route.latencyMax = latency;
+    }
+}
+
+void forward(int sockfd, std::vector<gateway::Route>& routes,
+             tx::Queue& txQueue) {
+    for (std::size_t count = 0; count < kForwardBatch; ++count) {
+        rx::Buffer buffer;
+        struct sockaddr_can addr;
+        struct iovec iov;
+        struct msghdr msg;
+        char control[CMSG_SPACE(sizeof(struct timespec))];
+        struct timespec received = {};
+
+        iov.iov_base = &buffer;
+        iov.iov_len = sizeof(buffer);
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &addr;
+        msg.msg_namelen = sizeof(addr);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        auto numBytes = ::recvmsg(sockfd, &msg, MSG_DONTWAIT);
+        if (-1 == numBytes) {
+            if (EAGAIN != errno && EINTR != errno)
+                std::perror("recvmsg");
+            return;
+        }
+
+        for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+                std::memcpy(&received, CMSG_DATA(cmsg), sizeof(received));
+        }
+
+        const auto type = rx::frameType(buffer, static_cast<std::size_t>(numBytes));
+        if (rx::Xl == type) {
+            forwardXl(sockfd, routes, addr.can_ifindex, buffer.xl,
+                      static_cast<std::size_t>(numBytes), toNanoseconds(received));
+            continue;
+        }
+
+        if (rx::Classic != type)
+            continue;
+
+        const struct can_frame& frame = buffer.classic;
+        for (std::size_t i = 0; i < routes.size(); ++i) {
+            auto& route = routes[i];
+
+            if (route.kernel || !gateway::matches(route, addr.can_ifindex, frame.can_id))
+                continue;
+
+            tx::Frame pending;
+            std::memset(&pending, 0, sizeof(pending));
+            std::memcpy(&pending.frame, &frame, sizeof(frame));
+
+            if (!gateway::applyModifications(route,
+                    *reinterpret_cast<struct can_frame*>(&pending.frame))) {
+                ++route.dropped;
+                continue;
+            }
+
+            pending.coalesce = route.coalesce;
+            pending.ifindex = route.destinationIndex;
+            pending.tag = static_cast<std::uint32_t>(i);
+            pending.timestamp = toNanoseconds(received);
+            txQueue.push(pending);
+        }
+
+        // Frames only wait in the queue while the destination pushes back
+        const auto now = tx::Clock::now();
+        if (txQueue.ready(now))
+            txQueue.flush(now);
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    using Clock = std::chrono::steady_clock;
+
+    // Options
+    const char* routesPath;
+    bool userspace = false;
+    unsigned long interval = 1;
+
+    // Service variables
+    struct sigaction sa;
+    std::vector<gateway::Route> routes;
+    gateway::Netlink netlink;
+    bool kernelRoutes = false;
+    bool userspaceRoutes = false;
+    int sockfd = -1;
+    tx::Queue txQueue(tx::kDefaultCapacity, [&](const tx::Frame& pending) {
+        return transmit(sockfd, routes, pending);
+    }, [&](const tx::Frame& discarded) {
+        ++routes[discarded.tag].dropped;
+    });
+
+    // Parse command line arguments
+    {
+        int opt;
+
+        // Parse option flags
+        while ((opt = ::getopt(argc, argv, "Vhui:")) != -1) {
+            switch (opt) {
+            case 'V':
+                version();
+                return EXIT_SUCCESS;
+            case 'h':
+                usage();
+                return EXIT_SUCCESS;
+            case 'u':
+                userspace = true;
+                break;
+            case 'i':
+                interval = std::strtoul(optarg, nullptr, 0);
+                break;
+            default:
+                usage();
+                return EXIT_FAILURE;
+            }
+        }
+
+        // Check for the one positional argument
+        if (optind != (argc - 1)) {
+            std::cerr << "Missing routing table option!" << std::endl;
+            usage();
+            return EXIT_FAILURE;
+        }
+
+        routesPath = argv[optind];
+    }
+
+    // Read the routing table
+    {
+        std::ifstream in(routesPath);
+        if (!in) {
+            std::perror(routesPath);
+            return EXIT_FAILURE;
+        }
+
+        if (!gateway::parseRoutes(in, routes))
+            return EXIT_FAILURE;
+
+        if (routes.empty() || routes.size() > kMaxRoutes) {
+            std::cerr << "Expected 1 to " << kMaxRoutes << " routes!" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Register signal handlers
+    sa.sa_handler = onSignal;
+    ::sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    ::sigaction(SIGINT, &sa, nullptr);
+    ::sigaction(SIGTERM, &sa, nullptr);
+    ::sigaction(SIGQUIT, &sa, nullptr);
+    ::sigaction(SIGHUP, &sa, nullptr);
+
+    // Initialize the signal value to zero
+    signalValue = 0;
+
+    // Install kernel rules, falling back to userspace per route
+    if (!userspace && !netlink.open())
+        userspace = true;
+
+    for (std::size_t i = 0; i < routes.size(); ++i) {
+        auto& route = routes[i];
+
+        route.uid = (static_cast<std::uint32_t>(::getpid()) << 8) |
+            static_cast<std::uint32_t>(i);
+        route.kernel = false;
+
+        if (!userspace && gateway::kernelExpressible(route)) {
+            const int rc = netlink.install(route);
+            if (0 == rc) {
+                route.kernel = true;
+            } else {
+                std::cerr << "Route " << i << ": CAN_GW rule rejected ("
+                          << std::strerror(rc) << "), using userspace"
+                          << std::endl;
+            }
+        }
+
+        kernelRoutes |= route.kernel;
+        userspaceRoutes |= !route.kernel;
+    }
+
+    if (userspaceRoutes) {
+        sockfd = openForwarder(routes);
+        if (-1 == sockfd)
+            goto errSetup;
+    }
+
+    // Log that the service is up and running
+    std::cout << "Started" << std::endl;
+
+    // Main loop
+    {
+        std::vector<std::uint64_t> previous(routes.size(), 0);
+        const auto period = std::chrono::seconds(interval ? interval : 1);
+        auto last = Clock::now();
+        auto next = last + period;
+
+        while (0 == signalValue) {
+            const auto now = Clock::now();
+
+            if (now >= next) {
+                if (kernelRoutes)
+                    netlink.updateCounters(routes);
+
+                if (interval) {
+                    report(routes, txQueue, previous,
+                        std::chrono::duration<double>(now - last).count());
+                }
+
+                last = now;
+                next = now + period;
+                continue;
+            }
+
+            // Wake for the report, a frame, or when the queue can make progress
+            auto wait = tx::pollTimeout(next - now);
+            const auto retry = tx::pollTimeout(txQueue.timeout(now));
+            if (retry >= 0 && retry < wait)
+                wait = retry;
+
+            // Without userspace routes there is only the report to wait for
+            struct pollfd fd = {
+                sockfd, static_cast<short>(POLLIN | txQueue.events()), 0
+            };
+            if (::poll(&fd, (-1 == sockfd) ? 0 : 1, wait) > 0 &&
+                (fd.revents & POLLIN))
+                forward(sockfd, routes, txQueue);
+
+            if (-1 != sockfd)
+                txQueue.flush(Clock::now());
+        }
+
+        // Final counters
+        if (kernelRoutes)
+            netlink.updateCounters(routes);
+        std::cout << std::endl;
+        report(routes, txQueue, previous,
+            std::chrono::duration<double>(Clock::now() - last).count());
+    }
+
+    // Cleanup
+    for (const auto& route : routes) {
+        if (route.kernel)
+            netlink.remove(route);
+    }
+
+    if (sockfd != -1 && ::close(sockfd) == -1) {
+        std::perror("close");
+        return errno;
+    }
+
+    std::cout << std::endl << "Bye!" << std::endl;
+    return EXIT_SUCCESS;
+
+    // Error handling (reverse order cleanup)
+errSetup:
+    for (const auto& route : routes) {
+        if (route.kernel)
+            netlink.remove(route);
+    }
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,560 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015, 2016 Jacob McGladdery
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+-------------------------------------------------------------------------------
+
+ISO-TP Interface Demo
+
+This service demonstrates ISO 15765-2 multi-frame transfers. For every ID pair
+given on the command line it receives ISO-TP messages, adds one to the value
+of each byte in the message, and sends the message back to the peer. Kernel
+CAN_ISOTP sockets are used when available. Otherwise the service falls back
+to the userspace engine in isotp.cpp which runs on a CAN_RAW socket.
+*/
+
+#include "isotp.h"
+
+#include <linux/can.h>
+#include <linux/can/isotp.h>
+#include <linux/can/raw.h>
+
+#include <fcntl.h>
+#include <net/if.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#define PROGNAME  "socketcan-isotp-demo"
+#define VERSION  "1.0.0"
+
+namespace {
+
+// Returned by runKernel() when the kernel has no CAN_ISOTP support
+constexpr int kUnavailable = -2;
+
+// Number of payload bytes shown when logging a message
+constexpr std::size_t kLogBytes = 16;
+
+struct Pair {
+    canid_t txId;
+    canid_t rxId;
+};
+
+std::sig_atomic_t signalValue;
+
+void onSignal(int value) {
+    signalValue = static_cast<decltype(signalValue)>(value);
+}
+
+void usage() {
+    std::cout << "Usage: " PROGNAME " [-h] [-V] [-u] [-p tx:rx]... [-b bs]"
+                 " [-m stmin] [-l dl] [-L len] interface" << std::endl
+              << "Options:" << std::endl
+              << "  -h  Display this information" << std::endl
+              << "  -V  Display version information" << std::endl
+              << "  -u  Always use the userspace ISO-TP engine" << std::endl
+              << "  -p  Add a TX:RX CAN ID pair in hex (default 7E8:7E0)"
+              << std::endl
+              << "  -b  Block size sent in flow control frames (default 0)"
+              << std::endl
+              << "  -m  STmin sent in flow control frames (default 0)"
+              << std::endl
+              << "  -l  Link layer data length, 8 or a CAN FD length of"
+                 " 12 to 64 (default 8)" << std::endl
+              << "  -L  Largest message length accepted, up to "
+              << isotp::kMaxLength << " (default 4095)" << std::endl
+              << std::endl;
+}
+
+void version() {
+    std::cout << PROGNAME " version " VERSION << std::endl
+              << "Compiled on " __DATE__ ", " __TIME__ << std::endl
+              << std::endl;
+}
+
+canid_t parseId(const char* text, char** end) {
+    auto id = static_cast<canid_t>(std::strtoul(text, end, 16));
+    return (id > CAN_SFF_MASK) ? (id | CAN_EFF_FLAG) : id;
+}
+
+bool parsePair(const char* text, Pair& pair) {
+    char* end;
+
+    pair.txId = parseId(text, &end);
+    if (end == text || *end != ':')
+        return false;
+
+    text = end + 1;
+    pair.rxId = parseId(text, &end);
+    return end != text && *end == '\0';
+}
+
+void logMessage(const char* direction, canid_t id,
+                const std::uint8_t* data, std::size_t length) {
+    std::cout << direction << "  "
+              << std::hex << std::uppercase << std::setfill('0')
+              << std::setw(3) << (id & CAN_EFF_MASK)
+              << std::dec << "  [" << length << "] "
+              << std::hex;
+    for (std::size_t i = 0; i < std::min(length, kLogBytes); ++i) {
+        std::cout << ' ' << std::setw(2) << static_cast<unsigned>(data[i]);
+    }
+    if (length > kLogBytes)
+        std::cout << " ...";
+    std::cout << std::endl;
+    std::cout.copyfmt(std::ios(nullptr));
+}
+
+void increment(std::uint8_t* data, std::size_t length) {
+    for (std::size_t i = 0; i < length; ++i) {
+        data[i] += 1;
+    }
+}
+
+int runKernel(int ifindex, const std::vector<Pair>& pairs,
+              const isotp::Options& options, isotp::BufferPool& pool) {
+    std::vector<struct pollfd> fds;
+    std::uint8_t* const buffer = pool.acquire();
+    int rc = EXIT_SUCCESS;
+
+    // Open one ISO-TP socket per ID pair
+    for (const auto& pair : pairs) {
+        struct sockaddr_can addr;
+        int sockfd;
+
+        sockfd = ::socket(PF_CAN, SOCK_DGRAM, CAN_ISOTP);
+        if (-1 == sockfd) {
+            if (fds.empty() && EPROTONOSUPPORT == errno) {
+                pool.release(buffer);
+                return kUnavailable;
+            }
+
+            std::perror("socket");
+            rc = errno;
+            goto cleanup;
+        }
+
+        fds.push_back({ sockfd, POLLIN, 0 });
+
+        {
+            struct can_isotp_options opts;
+            std::memset(&opts, 0, sizeof(opts));
+            opts.flags = CAN_ISOTP_TX_PADDING;
+            opts.txpad_content = options.padding;
+
+            struct can_isotp_fc_options fc;
+            fc.bs = options.blockSize;
+            fc.stmin = options.stMin;
+            fc.wftmax = 0;
+
+            if (::setsockopt(sockfd, SOL_CAN_ISOTP, CAN_ISOTP_OPTS,
+                             &opts, sizeof(opts)) == -1 ||
+                ::setsockopt(sockfd, SOL_CAN_ISOTP, CAN_ISOTP_RECV_FC,
+                             &fc, sizeof(fc)) == -1) {
+                std::perror("setsockopt isotp");
+                rc = errno;
+                goto cleanup;
+            }
+        }
+
+        if (options.txDataLength > CAN_MAX_DLEN) {
+            struct can_isotp_ll_options ll;
+            ll.mtu = CANFD_MTU;
+            ll.tx_dl = options.txDataLength;
+            ll.tx_flags = 0;
+
+            if (::setsockopt(sockfd, SOL_CAN_ISOTP, CAN_ISOTP_LL_OPTS,
+                             &ll, sizeof(ll)) == -1) {
+                std::perror("setsockopt isotp link layer");
+                rc = errno;
+                goto cleanup;
+            }
+        }
+
+        std::memset(&addr, 0, sizeof(addr));
+        addr.can_family = AF_CAN;
+        addr.can_ifindex = ifindex;
+        addr.can_addr.tp.tx_id = pair.txId;
+        addr.can_addr.tp.rx_id = pair.rxId;
+        if (::bind(sockfd, reinterpret_cast<struct sockaddr*>(&addr),
+                   sizeof(addr)) == -1) {
+            std::perror("bind");
+            rc = errno;
+            goto cleanup;
+        }
+    }
+
+    std::cout << "Started (kernel ISO-TP)" << std::endl;
+
+    // Main loop
+    while (0 == signalValue) {
+        if (::poll(fds.data(), fds.size(), -1) == -1) {
+            if (EINTR != errno)
+                std::perror("poll");
+            continue;
+        }
+
+        for (std::size_t i = 0; i < fds.size(); ++i) {
+            if (!(fds[i].revents & POLLIN))
+                continue;
+
+            // The kernel hands over one complete message per read
+            auto numBytes = ::read(fds[i].fd, buffer, pool.bufferSize());
+            if (numBytes <= 0) {
+                if (-1 == numBytes && EINTR != errno)
+                    std::perror("read");
+                continue;
+            }
+
+            const auto length = static_cast<std::size_t>(numBytes);
+            logMessage("RX", pairs[i].rxId, buffer, length);
+            increment(buffer, length);
+
+            if (::write(fds[i].fd, buffer, length) == -1) {
+                std::perror("write");
+                continue;
+            }
+            logMessage("TX", pairs[i].txId, buffer, length);
+        }
+    }
+
+cleanup:
+    for (const auto& fd : fds) {
+        ::close(fd.fd);
+    }
+    pool.release(buffer);
+    return rc;
+}
+
+int runUserspace(int ifindex, const std::vector<Pair>& pairs,
+                 const isotp::Options& options, isotp::BufferPool& pool) {
+    struct sockaddr_can addr;
+    struct pollfd fd;
+    std::vector<std::uint8_t> scratch(pool.bufferSize());
+    int flags;
+    int sockfd;
+
+    sockfd = ::socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    if (-1 == sockfd) {
+        std::perror("socket");
+        return errno;
+    }
+
+    // Only receive the frames addressed to one of our sessions
+    {
+        std::vector<struct can_filter> filter;
+        for (const auto& pair : pairs) {
+            const canid_t mask = (pair.rxId & CAN_EFF_FLAG)
+                ? (CAN_EFF_FLAG | CAN_EFF_MASK)
+                : (CAN_EFF_FLAG | CAN_SFF_MASK);
+            filter.push_back({ pair.rxId, mask });
+        }
+
+        if (::setsockopt(sockfd, SOL_CAN_RAW, CAN_RAW_FILTER, filter.data(),
+                         filter.size() * sizeof(filter[0])) == -1) {
+            std::perror("setsockopt filter");
+            goto errSetup;
+        }
+    }
+
+    if (options.txDataLength > CAN_MAX_DLEN) {
+        int enable = 1;
+
+        if (::setsockopt(sockfd, SOL_CAN_RAW, CAN_RAW_FD_FRAMES,
+                         &enable, sizeof(enable)) == -1) {
+            std::perror("setsockopt CAN FD");
+            goto errSetup;
+        }
+    }
+
+    addr.can_family = AF_CAN;
+    addr.can_ifindex = ifindex;
+    if (::bind(sockfd, reinterpret_cast<struct sockaddr*>(&addr),
+               sizeof(addr)) == -1) {
+        std::perror("bind");
+        goto errSetup;
+    }
+
+    // The engine is driven by poll, so reads and writes must not block
+    flags = ::fcntl(sockfd, F_GETFL, 0);
+    if (-1 == flags || ::fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        std::perror("fcntl");
+        goto errSetup;
+    }
+
+    {
+        isotp::Engine* enginePtr = nullptr;
+        isotp::Clock::time_point received;
+        isotp::Engine engine(sockfd, pool,
+            [&](int session, const std::uint8_t* data, std::size_t length) {
+                const auto& pair = pairs[session];
+                logMessage("RX", pair.rxId, data, length);
+
+                std::memcpy(scratch.data(), data, length);
+                increment(scratch.data(), length);
+                if (!enginePtr->send(session, scratch.data(), length,
+                                     received)) {
+                    logMessage("TX busy, dropped", pair.txId,
+                               scratch.data(), length);
+                    return;
+                }
+                logMessage("TX", pair.txId, scratch.data(), length);
+            });
+        enginePtr = &engine;
+
+        for (const auto& pair : pairs) {
+            auto sessionOptions = options;
+            sessionOptions.txId = pair.txId;
+            sessionOptions.rxId = pair.rxId;
+            if (engine.addSession(sessionOptions) == -1) {
+                std::cerr << "Too many ID pairs or duplicate RX ID!"
+                          << std::endl;
+                goto errSetup;
+            }
+        }
+
+        std::cout << "Started (userspace ISO-TP)" << std::endl;
+
+        fd.fd = sockfd;
+        fd.events = POLLIN;
+
+        // Main loop
+        while (0 == signalValue) {
+            const auto wait = engine.timeout(isotp::Clock::now());
+            struct timespec ts;
+            struct timespec* tsp = nullptr;
+
+            if (wait.count() >= 0) {
+                const auto ns = std::chrono::duration_cast<
+                    std::chrono::nanoseconds>(wait).count();
+                ts.tv_sec = ns / 1000000000;
+                ts.tv_nsec = ns % 1000000000;
+                tsp = &ts;
+            }
+
+            if (::ppoll(&fd, 1, tsp, nullptr) == -1) {
+                if (EINTR != errno)
+                    std::perror("ppoll");
+                continue;
+            }
+
+            // Drain the socket before servicing the transmit side
+            if (fd.revents & POLLIN) {
+                struct canfd_frame frame;
+
+                while (::read(sockfd, &frame, CANFD_MTU) > 0) {
+                    received = isotp::Clock::now();
+                    engine.receive(frame, received);
+                }
+
+                if (EAGAIN != errno && EINTR != errno)
+                    std::perror("read");
+            }
+
+            engine.service(isotp::Clock::now());
+        }
+    }
+
+    if (::close(sockfd) == -1) {
+        std::perror("close");
+        return errno;
+    }
+
+    return EXIT_SUCCESS;
+
+errSetup:
+    ::close(sockfd);
+    return errno;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    // Options
+    const char* interface;
+    bool userspace = false;
+    std::vector<Pair> pairs;
+    unsigned long maxLength = isotp::kMaxShortLength;
+    unsigned long txDataLength = CAN_MAX_DLEN;
+    isotp::Options options;
+
+    // Service variables
+    struct sigaction sa;
+    struct ifreq ifr;
+    int sockfd;
+    int rc;
+
+    options.txId = 0;
+    options.rxId = 0;
+    options.blockSize = 0;
+    options.stMin = 0;
+    options.txDataLength = CAN_MAX_DLEN;
+    options.padding = CAN_ISOTP_DEFAULT_PAD_CONTENT;
+
+    // Parse command line arguments
+    {
+        int opt;
+
+        // Parse option flags
+        while ((opt = ::getopt(argc, argv, "Vhup:b:m:l:L:")) != -1) {
+            switch (opt) {
+            case 'V':
+                version();
+                return EXIT_SUCCESS;
+            case 'h':
+                usage();
+                return EXIT_SUCCESS;
+            case 'u':
+                userspace = true;
+                break;
+            case 'p':
+            {
+                Pair pair;
+                if (!parsePair(optarg, pair)) {
+                    std::cerr << "Invalid ID pair: " << optarg << std::endl;
+                    return EXIT_FAILURE;
+                }
+                pairs.push_back(pair);
+            }
+                break;
+            case 'b':
+                options.blockSize = static_cast<std::uint8_t>(
+                    std::strtoul(optarg, nullptr, 0));
+                break;
+            case 'm':
+                options.stMin = static_cast<std::uint8_t>(
+                    std::strtoul(optarg, nullptr, 0));
+                break;
+            case 'l':
+                txDataLength = std::strtoul(optarg, nullptr, 0);
+                break;
+            case 'L':
+                maxLength = std::strtoul(optarg, nullptr, 0);
+                break;
+            default:
+                usage();
+                return EXIT_FAILURE;
+            }
+        }
+
+        // Check for the one positional argument
+        if (optind != (argc - 1)) {
+            std::cerr << "Missing network interface option!" << std::endl;
+            usage();
+            return EXIT_FAILURE;
+        }
+
+        // Set the network interface to use
+        interface = argv[optind];
+    }
+
+    // Classic CAN, or one of the CAN FD lengths 12, 16, 20, 24, 32, 48 and 64
+    if (txDataLength < CAN_MAX_DLEN || !isotp::validDataLength(txDataLength)) {
+        std::cerr << "Invalid link layer data length!" << std::endl;
+        return EXIT_FAILURE;
+    }
+    options.txDataLength = static_cast<std::uint8_t>(txDataLength);
+
+    // Every session gets two buffers of this size up front
+    if (0 == maxLength || maxLength > isotp::kMaxLength) {
+        std::cerr << "Invalid largest message length!" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (pairs.empty())
+        pairs.push_back({ 0x7E8, 0x7E0 });
+
+    if (pairs.size() > isotp::kMaxSessions) {
+        std::cerr << "Too many ID pairs!" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // A received frame must identify exactly one pair
+    for (std::size_t i = 0; i < pairs.size(); ++i) {
+        for (std::size_t j = 0; j < i; ++j) {
+            if (pairs[i].rxId == pairs[j].rxId) {
+                std::cerr << "Duplicate RX ID in ID pairs: " << std::hex
+                          << std::uppercase << pairs[i].rxId << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    // Register signal handlers
+    sa.sa_handler = onSignal;
+    ::sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    ::sigaction(SIGINT, &sa, nullptr);
+    ::sigaction(SIGTERM, &sa, nullptr);
+    ::sigaction(SIGQUIT, &sa, nullptr);
+    ::sigaction(SIGHUP, &sa, nullptr);
+
+    // Initialize the signal value to zero
+    signalValue = 0;
+
+    // Get the index of the network interface
+    sockfd = ::socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    if (-1 == sockfd) {
+        std::perror("socket");
+        return errno;
+    }
+
+    std::strncpy(ifr.ifr_name, interface, IFNAMSIZ);
+    if (::ioctl(sockfd, SIOCGIFINDEX, &ifr) == -1) {
+        std::perror("ioctl");
+        ::close(sockfd);
+        return errno;
+    }
+    ::close(sockfd);
+
+    // One reassembly and one transmit buffer per session
+    {
+        isotp::BufferPool pool(2 * pairs.size(), maxLength);
+
+        rc = kUnavailable;
+        if (!userspace)
+            rc = runKernel(ifr.ifr_ifindex, pairs, options, pool);
+
+        if (kUnavailable == rc)
+            rc = runUserspace(ifr.ifr_ifindex, pairs, options, pool);
+    }
+
+    if (EXIT_SUCCESS == rc)
+        std::cout << std::endl << "Bye!" << std::endl;
+
+    return rc;
+}
@@ -26,26 +26,34 @@ THE SOFTWARE.
 Raw Interface Demo
 
 This service demonstrates how to read CAN traffic using the SocketCAN Raw
-interface. Specifically, this service shows how to read CAN FD frame, filter by
-message ID, perform a blocking read, and process some hypothetical CAN
-messages. The exact format of the CAN messages which this service will
-recognize is given in the README file.
+interface. Specifically, this service shows how to read CAN FD and CAN XL
+frames, filter by message ID, perform a blocking batched read, and process some
+hypothetical CAN messages. Decoded signals can be downsampled before they are
+logged, as configured in an aggregation file. The exact format of the CAN
+messages which this service will recognize is given in the README file.
 
 TODO: Specify the message formats in the README file.
 */
 
+#include "aggregator.h"
+#include "can-stats.h"
+#include "profiler.h"
+#include "raw-decoder.h"
+#include "rx-batch.h"
+#include "signal-cache.h"
+
 #include <linux/can.h>
 #include <linux/can/raw.h>
 
-#include <endian.h>
 #include <net/if.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include <chrono>
-#include <iomanip>
+#include <fstream>
 #include <iostream>
 #include <thread>
 
@@ -60,31 +68,37 @@ TODO: Specify the message formats in the README file.
 
 namespace {
 
-struct EngineFrame {
-    std::uint16_t rpm;
-    // TODO: Some more hypothetical data
-};
+std::sig_atomic_t signalValue;
+
+// Latest decoded signal values shared with other processes
+signals::Region* signalCache;
 
-struct VehicleFrame {
-    // TODO: Some hypothetical vehicle status measurements
-};
+// Per-ID receive statistics
+stats::Table canStats;
 
-struct BodyControllerFrame {
-    // TODO: Some hypothetical vehicle settings flags
-};
+// Receive buffers, each large enough for a CAN XL frame
+rx::Batch rxBatch;
 
-std::sig_atomic_t signalValue;
+// How often open aggregation windows are checked while the bus is idle
+constexpr auto kAggregateInterval = std::chrono::milliseconds(10);
 
 void onSignal(int value) {
     signalValue = static_cast<decltype(signalValue)>(value);
 }
 
 void usage() {
-    std::cout << "Usage: " PROGNAME " [-h] [-V] [-f] interface" << std::endl
+    std::cout << "Usage: " PROGNAME " [-h] [-V] [-f] [-A path] [-s name]"
+                 " [-t path] interface" << std::endl
               << "Options:" << std::endl
               << "  -h  Display this information" << std::endl
               << "  -V  Display version information" << std::endl
               << "  -f  Run in the foreground" << std::endl
+              << "  -A  Aggregate signals as configured in a file"
+              << std::endl
+              << "  -s  Shared memory name of the signal cache"
+                 " (default " << signals::kDefaultName << ")" << std::endl
+              << "  -t  Serve per-ID statistics on a Unix domain socket"
+              << std::endl
               << std::endl;
 }
 
@@ -94,40 +108,6 @@ void version() {
               << std::endl;
 }
 
-void processFrame(const struct canfd_frame& frame) {
-    switch (frame.can_id) {
-    case 0x0A0:
-    {
-        EngineFrame engine;
-        engine.rpm = be16toh(*(std::uint16_t *)(frame.data + 0));
-        std::cout << "RPM: " << engine.rpm << std::endl;
-    }
-        break;
-    case 0x110:
-    {
-        // TODO: Work!
-        // VehicleFrame vehicle;
-        std::cout << "Got 0x110" << std::endl; // XXX
-    }
-        break;
-    case 0x320:
-    {
-        // TODO: Work!
-        // BodyControllerFrame bodyController;
-        std::cout << "Got 0x320" << std::endl; // XXX
-    }
-        break;
-    default:
-        // Should never get here if the receive filters were set up correctly
-        std::cerr << "Unexpected CAN ID: 0x"
-                  << std::hex << std::uppercase
-                  << std::setw(3) << std::setfill('0')
-                  << frame.can_id << std::endl;
-        std::cerr.copyfmt(std::ios(nullptr));
-        break;
-    }
-}
-
 } // namespace
 
 int main(int argc, char** argv) {
@@ -135,12 +115,21 @@ int main(int argc, char** argv) {
 
     // Options
     const char* interface;
+    const char* cacheName = signals::kDefaultName;
+    const char* telemetryPath = nullptr;
+    const char* aggregatePath = nullptr;
     bool foreground = false;
 
     // Service variables
     struct sigaction sa;
     int rc;
 
+    // Telemetry is served from its own thread
+    stats::Exporter telemetry(canStats);
+
+    // Downsamples the decoded signals before they are logged
+    aggregate::Aggregator aggregator(decoder::printSignal);
+
     // CAN connection variables
     struct sockaddr_can addr;
     struct ifreq ifr;
@@ -151,8 +140,11 @@ int main(int argc, char** argv) {
         int opt;
 
         // Parse option flags
-        while ((opt = ::getopt(argc, argv, "Vfh")) != -1) {
+        while ((opt = ::getopt(argc, argv, "A:Vfhs:t:")) != -1) {
             switch (opt) {
+            case 'A':
+                aggregatePath = optarg;
+                break;
             case 'V':
                 version();
                 return EXIT_SUCCESS;
@@ -162,6 +154,12 @@ int main(int argc, char** argv) {
             case 'h':
                 usage();
                 return EXIT_SUCCESS;
+            case 's':
+                cacheName = optarg;
+                break;
+            case 't':
+                telemetryPath = optarg;
+                break;
             default:
                 usage();
                 return EXIT_FAILURE;
@@ -179,6 +177,18 @@ int main(int argc, char** argv) {
         interface = argv[optind];
     }
 
+    // Read the aggregation configuration
+    if (aggregatePath) {
+        std::ifstream in(aggregatePath);
+        if (!in) {
+            std::perror(aggregatePath);
+            return EXIT_FAILURE;
+        }
+
+        if (!aggregator.parseConfig(in))
+            return EXIT_FAILURE;
+    }
+
     // Check if the service should be run as a daemon
     if (!foreground) {
         if (::daemon(0, 1) == -1) {
@@ -195,6 +205,7 @@ int main(int argc, char** argv) {
     ::sigaction(SIGTERM, &sa, nullptr);
     ::sigaction(SIGQUIT, &sa, nullptr);
     ::sigaction(SIGHUP, &sa, nullptr);
+    PROFILE_INSTALL();
 
     // Initialize the signal value to zero
     signalValue = 0;
@@ -208,7 +219,7 @@ int main(int argc, char** argv) {
 
     // Set a receive filter so we only receive select CAN IDs
     {
-        struct can_filter filter[3];
+        struct can_filter filter[4];
         filter[0].can_id   = 0x0A0;
         filter[0].can_mask = CAN_SFF_MASK;
         filter[1].can_id   = 0x110;
@@ -216,6 +227,10 @@ int main(int argc, char** argv) {
         filter[2].can_id   = 0x320;
         filter[2].can_mask = CAN_SFF_MASK;
 
+        // CAN XL frames are matched on their priority ID
+        filter[3].can_id   = decoder::kXlEnginePriority;
+        filter[3].can_mask = CAN_SFF_MASK;
+
         rc = ::setsockopt(
             sockfd,
             SOL_CAN_RAW,
@@ -246,6 +261,10 @@ int main(int argc, char** argv) {
         }
     }
 
+    // Enable reception of CAN XL frames, where the kernel supports them
+    if (!rx::enableXlFrames(sockfd))
+        std::cerr << "CAN XL frames are not supported" << std::endl;
+
     // Get the index of the network interface
     std::strncpy(ifr.ifr_name, interface, IFNAMSIZ);
     if (::ioctl(sockfd, SIOCGIFINDEX, &ifr) == -1) {
@@ -266,36 +285,97 @@ int main(int argc, char** argv) {
         goto errSetup;
     }
 
+    // Publish decoded signals for other processes on this host
+    signalCache = signals::create(cacheName);
+    if (!signalCache)
+        goto errSetup;
+
+    // Start serving statistics, after daemon() so the thread survives
+    if (telemetryPath && !telemetry.start(telemetryPath))
+        goto errSetup;
+
     // Log that the service is up and running
     std::cout << "Started" << std::endl;
 
     // Main loop
     while (0 == signalValue) {
-        struct canfd_frame frame;
-
-        // Read in a CAN frame
-        auto numBytes = ::read(sockfd, &frame, CANFD_MTU);
-        switch (numBytes) {
-        case CAN_MTU:
-            processFrame(frame);
-            break;
-        case CANFD_MTU:
-            // TODO: Should make an example for CAN FD
-            break;
-        case -1:
+        // Dump the stage profile if SIGUSR1 was received
+        PROFILE_CHECK();
+
+        // Wake up periodically so windows still close while the bus is quiet
+        struct pollfd fd = { sockfd, POLLIN, 0 };
+        const int timeout = aggregator.configured()
+            ? static_cast<int>(kAggregateInterval.count()) : -1;
+        rc = ::poll(&fd, 1, timeout);
+        if (-1 == rc) {
             // Check the signal value on interrupt
-            if (EINTR == errno)
+            if (EINTR != errno) {
+                std::perror("poll");
+                std::this_thread::sleep_for(100ms);
+            }
+            continue;
+        }
+
+        if (0 == rc) {
+            aggregator.advance(signals::now());
+            std::cout.flush();
+            continue;
+        }
+
+        // The wait is not charged to any stage
+        PROFILE_START();
+
+        // Read in every CAN frame which is queued
+        const int count = rxBatch.receive(sockfd);
+        PROFILE_LAP(Read);
+        if (-1 == count) {
+            if (EINTR == errno || EAGAIN == errno || EWOULDBLOCK == errno)
                 continue;
 
             // Delay before continuing
-            std::perror("read");
+            std::perror("recvmmsg");
             std::this_thread::sleep_for(100ms);
-        default:
             continue;
         }
+
+        // Hand the frames to the decoders where they lie
+        for (int i = 0; i < count; ++i) {
+            const auto& buffer = rxBatch[i];
+            const auto timestamp = signals::now();
+
+            switch (rx::frameType(buffer, rxBatch.size(i))) {
+            case rx::Classic:
+                canStats.record(buffer.fd.can_id, buffer.fd.len, timestamp);
+                decoder::processFrame(buffer.fd, timestamp, *signalCache, canStats,
+                                      aggregator);
+                break;
+            case rx::Fd:
+                canStats.record(buffer.fd.can_id, buffer.fd.len, timestamp);
+                // TODO: Should make an example for CAN FD
+                break;
+            case rx::Xl:
+                canStats.recordXl(buffer.xl.prio, buffer.xl.len, timestamp);
+                decoder::processXlFrame(buffer.xl, timestamp, *signalCache, canStats,
+                                        aggregator);
+                break;
+            default:
+                break;
+            }
+        }
+
+        // Close the windows which ended during the batch
+        aggregator.advance(signals::now());
+
+        // The decoders only end lines, so the log is written once per batch
+        std::cout.flush();
     }
 
     // Cleanup
+    aggregator.flush(signals::now());
+    PROFILE_DUMP();
+    telemetry.stop();
+    signals::destroy(signalCache, cacheName);
+
     if (::close(sockfd) == -1) {
         std::perror("close");
         return errno;
@@ -306,6 +386,7 @@ int main(int argc, char** argv) {
 
     // Error handling (reverse order cleanup)
 errSetup:
+    signals::destroy(signalCache, cacheName);
     ::close(sockfd);
 errSocket:
     return errno;
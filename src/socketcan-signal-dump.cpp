@@ -0,0 +1,169 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015, 2016 Jacob McGladdery
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+-------------------------------------------------------------------------------
+
+Signal Cache Reader Demo
+
+This program demonstrates reading the latest signal values published by the
+raw interface demo. It maps the shared memory signal cache read-only and
+prints a consistent snapshot of every signal, either once or periodically.
+No CAN socket is opened and no frames are decoded again.
+*/
+
+#include "signal-cache.h"
+
+#include <unistd.h>
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+#include <csignal>
+#include <cstdlib>
+
+#define PROGNAME  "socketcan-signal-dump"
+#define VERSION  "1.0.0"
+
+namespace {
+
+std::sig_atomic_t signalValue;
+
+void onSignal(int value) {
+    signalValue = static_cast<decltype(signalValue)>(value);
+}
+
+void usage() {
+    std::cout << "Usage: " PROGNAME " [-h] [-V] [-s name] [-w ms]" << std::endl
+              << "Options:" << std::endl
+              << "  -h  Display this information" << std::endl
+              << "  -V  Display version information" << std::endl
+              << "  -s  Shared memory name of the signal cache"
+                 " (default " << signals::kDefaultName << ")" << std::endl
+              << "  -w  Print the signals again every ms milliseconds"
+              << std::endl
+              << std::endl;
+}
+
+void version() {
+    std::cout << PROGNAME " version " VERSION << std::endl
+              << "Compiled on " __DATE__ ", " __TIME__ << std::endl
+              << std::endl;
+}
+
+void dump(const signals::Region& region) {
+    const auto now = signals::now();
+
+    std::cout << std::left << std::setw(signals::kNameSize) << "Signal"
+              << std::right << std::setw(14) << "Value"
+              << std::setw(14) << "Updates"
+              << std::setw(14) << "Age ms" << std::endl;
+
+    for (std::uint32_t i = 0; i < signals::NumSignals; ++i) {
+        const auto& slot = region.slots[i];
+        signals::Snapshot snapshot;
+
+        signals::read(slot, snapshot);
+
+        std::cout << std::left << std::setw(signals::kNameSize) << slot.name
+                  << std::right << std::setw(14) << snapshot.value
+                  << std::setw(14) << snapshot.updates;
+        if (snapshot.updates > 0) {
+            std::cout << std::setw(14) << std::fixed << std::setprecision(3)
+                      << ((now - snapshot.timestamp) / 1e6);
+        } else {
+            std::cout << std::setw(14) << "-";
+        }
+        std::cout << std::endl;
+    }
+
+    std::cout.copyfmt(std::ios(nullptr));
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    // Options
+    const char* cacheName = signals::kDefaultName;
+    unsigned long watch = 0;
+
+    // Service variables
+    struct sigaction sa;
+    const signals::Region* region;
+
+    // Parse command line arguments
+    {
+        int opt;
+
+        // Parse option flags
+        while ((opt = ::getopt(argc, argv, "Vhs:w:")) != -1) {
+            switch (opt) {
+            case 'V':
+                version();
+                return EXIT_SUCCESS;
+            case 'h':
+                usage();
+                return EXIT_SUCCESS;
+            case 's':
+                cacheName = optarg;
+                break;
+            case 'w':
+                watch = std::strtoul(optarg, nullptr, 0);
+                break;
+            default:
+                usage();
+                return EXIT_FAILURE;
+            }
+        }
+
+        if (optind != argc) {
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Register signal handlers
+    sa.sa_handler = onSignal;
+    ::sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    ::sigaction(SIGINT, &sa, nullptr);
+    ::sigaction(SIGTERM, &sa, nullptr);
+
+    // Initialize the signal value to zero
+    signalValue = 0;
+
+    region = signals::attach(cacheName);
+    if (!region)
+        return EXIT_FAILURE;
+
+    dump(*region);
+    while (watch && 0 == signalValue) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(watch));
+        std::cout << std::endl;
+        dump(*region);
+    }
+
+    signals::detach(region);
+    return EXIT_SUCCESS;
+}
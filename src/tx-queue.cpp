@@ -0,0 +1,252 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015, 2016 Jacob McGladdery
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "tx-queue.h"
+
+#include <poll.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <utility>
+
+#include <cerrno>
+#include <cstdio>
+
+namespace tx {
+
+namespace {
+
+// Retry delays while the device queue is full
+constexpr auto kMinBackoff = std::chrono::milliseconds(1);
+constexpr auto kMaxBackoff = std::chrono::milliseconds(32);
+
+} // namespace
+
+std::uint32_t arbitration(canid_t id) {
+    const std::uint32_t rtr = (id & CAN_RTR_FLAG) ? 1 : 0;
+
+    // Base ID, SRR or RTR, IDE, ID extension and RTR, in bus order
+    if (!(id & CAN_EFF_FLAG))
+        return ((id & CAN_SFF_MASK) << 21) | (rtr << 20);
+
+    const std::uint32_t base = (id & CAN_EFF_MASK) >> 18;
+    const std::uint32_t extension = id & 0x3FFFF;
+    return (base << 21) | (1u << 20) | (1u << 19) | (extension << 1) | rtr;
+}
+
+int pollTimeout(Clock::duration wait) {
+    if (wait < Clock::duration::zero())
+        return -1;
+
+    const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        wait + std::chrono::milliseconds(1) - Clock::duration(1));
+    return static_cast<int>(ms.count());
+}
+
+bool limitSendBuffer(int sockfd) {
+    int size = 0; // Clamped to the kernel minimum
+
+    if (::setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size)) == -1) {
+        std::perror("setsockopt SO_SNDBUF");
+        return false;
+    }
+
+    return true;
+}
+
+Queue::Queue(std::size_t capacity, Transmit transmit, Discard discard)
+    : capacity_(capacity > 0 ? capacity : kDefaultCapacity)
+    , transmit_(std::move(transmit))
+    , discard_(std::move(discard))
+    , sequence_(0)
+    , waiting_(false)
+    , backoff_(Clock::duration::zero())
+    , sent_(0)
+    , replaced_(0)
+    , dropped_(0)
+    , failed_(0)
+{
+    heap_.reserve(capacity_);
+    positions_.reserve(capacity_);
+}
+
+std::uint64_t Queue::keyOf(const Frame& frame) {
+    return (static_cast<std::uint64_t>(static_cast<std::uint32_t>(frame.ifindex)) << 32) |
+        frame.frame.can_id;
+}
+
+bool Queue::push(const Frame& frame) {
+    const auto key = keyOf(frame);
+
+    // The newest payload takes over the stale frame's place in line
+    if (frame.coalesce) {
+        const auto it = positions_.find(key);
+        if (it != positions_.end()) {
+            if (discard_)
+                discard_(heap_[it->second].frame);
+            heap_[it->second].frame = frame;
+            ++replaced_;
+            return true;
+        }
+    }
+
+    Entry entry;
+    entry.order = (static_cast<std::uint64_t>(arbitration(frame.frame.can_id)) << 32) |
+        sequence_++;
+    entry.key = key;
+    entry.frame = frame;
+
+    // Make room by dropping the lowest priority frame, which is a leaf
+    if (heap_.size() >= capacity_) {
+        std::size_t worst = heap_.size() / 2;
+        for (std::size_t i = worst + 1; i < heap_.size(); ++i) {
+            if (heap_[i].order > heap_[worst].order)
+                worst = i;
+        }
+
+        ++dropped_;
+        if (entry.order > heap_[worst].order) {
+            if (discard_)
+                discard_(frame);
+            return false;
+        }
+        if (discard_)
+            discard_(heap_[worst].frame);
+        removeAt(worst);
+    }
+
+    heap_.emplace_back();
+    place(heap_.size() - 1, std::move(entry));
+    siftUp(heap_.size() - 1);
+    return true;
+}
+
+bool Queue::ready(Clock::time_point now) const {
+    return !waiting_ && !(backoff_ > Clock::duration::zero() && now < retry_);
+}
+
+void Queue::flush(Clock::time_point now) {
+    waiting_ = false;
+
+    if (backoff_ > Clock::duration::zero() && now < retry_)
+        return;
+
+    while (!heap_.empty()) {
+        const int rc = transmit_(heap_.front().frame);
+
+        switch (rc) {
+        case 0:
+            ++sent_;
+            backoff_ = Clock::duration::zero();
+            removeAt(0);
+            break;
+        case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+        case EWOULDBLOCK:
+#endif
+            waiting_ = true;
+            return;
+        case ENOBUFS:
+            backoff_ = (backoff_ > Clock::duration::zero())
+                ? std::min<Clock::duration>(2 * backoff_, kMaxBackoff)
+                : Clock::duration(kMinBackoff);
+            retry_ = now + backoff_;
+            return;
+        default:
+            // Not a matter of congestion, so retrying will not help
+            ++failed_;
+            removeAt(0);
+            break;
+        }
+    }
+}
+
+short Queue::events() const {
+    return (waiting_ && !heap_.empty()) ? POLLOUT : 0;
+}
+
+Clock::duration Queue::timeout(Clock::time_point now) const {
+    if (heap_.empty() || waiting_)
+        return Clock::duration(-1);
+
+    if (backoff_ > Clock::duration::zero() && now < retry_)
+        return retry_ - now;
+
+    return Clock::duration::zero();
+}
+
+void Queue::place(std::size_t index, Entry&& entry) {
+    heap_[index] = std::move(entry);
+    if (heap_[index].frame.coalesce)
+        positions_[heap_[index].key] = index;
+}
+
+void Queue::siftUp(std::size_t index) {
+    Entry entry = std::move(heap_[index]);
+
+    while (index > 0) {
+        const std::size_t parent = (index - 1) / 2;
+        if (heap_[parent].order <= entry.order)
+            break;
+        place(index, std::move(heap_[parent]));
+        index = parent;
+    }
+
+    place(index, std::move(entry));
+}
+
+void Queue::siftDown(std::size_t index) {
+    Entry entry = std::move(heap_[index]);
+
+    for (;;) {
+        std::size_t child = 2 * index + 1;
+        if (child >= heap_.size())
+            break;
+        if (child + 1 < heap_.size() && heap_[child + 1].order < heap_[child].order)
+            ++child;
+        if (entry.order <= heap_[child].order)
+            break;
+        place(index, std::move(heap_[child]));
+        index = child;
+    }
+
+    place(index, std::move(entry));
+}
+
+void Queue::removeAt(std::size_t index) {
+    if (heap_[index].frame.coalesce)
+        positions_.erase(heap_[index].key);
+
+    const std::size_t last = heap_.size() - 1;
+    if (index != last) {
+        place(index, std::move(heap_[last]));
+        heap_.pop_back();
+        siftDown(index);
+        siftUp(index);
+    } else {
+        heap_.pop_back();
+    }
+}
+
+} // namespace tx
@@ -0,0 +1,145 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015, 2016 Jacob McGladdery
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+-------------------------------------------------------------------------------
+
+Priority Transmit Queue
+
+A userspace scheduler in front of a CAN socket's write path. Pending frames
+are kept in a heap ordered the way the bus arbitrates, so an urgent low ID
+never waits behind bulk traffic. A frame which allows coalescing replaces a
+pending frame for the same ID and destination in place, since only the latest
+value of a periodic signal is of any use once the bus is congested. Frames of
+sequences, such as ISO-TP transfers, leave coalescing off and queue up.
+
+When the socket buffer is full the write fails with EAGAIN and the owner polls
+for POLLOUT. When the device queue itself overflows the write fails with
+ENOBUFS, for which there is no readiness event, so the queue backs off on a
+timer instead. Either way the loop sleeps rather than spinning on write().
+*/
+
+#ifndef _TX_QUEUE_H_
+#define _TX_QUEUE_H_
+
+#include <linux/can.h>
+
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace tx {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr std::size_t kDefaultCapacity = 256;
+
+struct Frame {
+    struct canfd_frame frame;
+    bool fd;
+    bool coalesce;           // May replace a pending frame with the same key
+    int ifindex;             // Destination of an unbound socket, otherwise 0
+    std::uint32_t tag;       // Caller data, such as a route index
+    std::uint64_t timestamp; // Caller data, such as the receive time
+};
+
+// Lower values win arbitration on the bus
+std::uint32_t arbitration(canid_t id);
+
+// Milliseconds for poll(), rounded up; -1 for a negative duration
+int pollTimeout(Clock::duration wait);
+
+// Shrink the socket buffer so congestion shows up as EAGAIN before ENOBUFS
+bool limitSendBuffer(int sockfd);
+
+class Queue {
+public:
+    // Writes one frame; returns zero or the errno value of the failure
+    using Transmit = std::function<int(const Frame&)>;
+
+    // Told about every frame which is replaced or dropped without being sent
+    using Discard = std::function<void(const Frame&)>;
+
+    Queue(std::size_t capacity, Transmit transmit, Discard discard = nullptr);
+
+    Queue(const Queue&) = delete;
+    Queue& operator=(const Queue&) = delete;
+
+    // When full, the lowest priority frame is dropped
+    bool push(const Frame& frame);
+
+    // Whether flush() would write now rather than wait for the device
+    bool ready(Clock::time_point now) const;
+
+    // Write pending frames in priority order until the device pushes back
+    void flush(Clock::time_point now);
+
+    bool empty() const { return heap_.empty(); }
+    std::size_t size() const { return heap_.size(); }
+
+    // Poll events to wait for besides the caller's own
+    short events() const;
+
+    // Time until flush() should be retried, or a negative duration if never
+    Clock::duration timeout(Clock::time_point now) const;
+
+    std::uint64_t sent() const { return sent_; }
+    std::uint64_t replaced() const { return replaced_; }
+    std::uint64_t dropped() const { return dropped_; }
+    std::uint64_t failed() const { return failed_; }
+
+private:
+    struct Entry {
+        std::uint64_t order; // Arbitration, then arrival
+        std::uint64_t key;   // Destination and ID, if coalescing
+        Frame frame;
+    };
+
+    static std::uint64_t keyOf(const Frame& frame);
+
+    void place(std::size_t index, Entry&& entry);
+    void siftUp(std::size_t index);
+    void siftDown(std::size_t index);
+    void removeAt(std::size_t index);
+
+    std::size_t capacity_;
+    Transmit transmit_;
+    Discard discard_;
+    std::vector<Entry> heap_;
+    std::unordered_map<std::uint64_t, std::size_t> positions_;
+    std::uint32_t sequence_;
+    bool waiting_; // For POLLOUT after EAGAIN
+    Clock::duration backoff_;
+    Clock::time_point retry_;
+    std::uint64_t sent_;
+    std::uint64_t replaced_;
+    std::uint64_t dropped_;
+    std::uint64_t failed_;
+};
+
+} // namespace tx
+
+#endif /* _TX_QUEUE_H_ */
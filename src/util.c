@@ -39,3 +39,14 @@ void print_can_frame(const struct can_frame * const frame)
     }
 }
 
+void increment_can_frame(struct can_frame * const frame)
+{
+    unsigned char *data = frame->data;
+    const unsigned int dlc = frame->can_dlc;
+    unsigned int i;
+
+    for (i = 0; i < dlc; ++i)
+    {
+        data[i] += 1;
+    }
+}
@@ -32,6 +32,7 @@ extern "C" {
 #endif
 
 void print_can_frame(const struct can_frame * const frame);
+void increment_can_frame(struct can_frame * const frame);
 
 #ifdef __cplusplus
 }